@@ -17,7 +17,7 @@ int main(void)
 {
   MicroBench mb;
 
-  micro_bench_clear(&mb);
+  micro_bench_init(&mb);
 
   printf("Calculating fibonacci numbers...\n");
   for (volatile int i = 0; i < 10; ++i)
@@ -98,18 +98,122 @@ extern "C" {
   #define MICRO_BENCH_DEF extern
 #endif
 
+// Config: Maximum number of samples in a trend detection window
+#ifndef MICRO_BENCH_TREND_MAX_WINDOW
+  #define MICRO_BENCH_TREND_MAX_WINDOW 64
+#endif
+
+// Config: Record the start of the program for the startup tool
+// A constructor marks "constructor" with `micro_bench_startup_mark`
+// as soon as the dynamic loader is done, when the program runs under
+// `micro_bench_startup_run`. Define it in the program being measured.
+//
+//   #define MICRO_BENCH_STARTUP
+
+// Config: Emit USDT probes for tracers such as bpftrace and perf
+// Probes "start" and "stop" in `micro_bench_start` and
+// `micro_bench_stop`, and "lock_acquire" and "lock_release" in the
+// lock profiler, in provider "micro_bench". They use <sys/sdt.h>
+// when available and an equivalent definition otherwise (GCC or
+// Clang, ELF, x86-64 or AArch64), and cost a nop when not traced.
+//
+//   #define MICRO_BENCH_USDT
+
+// Config: Maximum number of report metadata entries and the size of
+// their keys and values
+#ifndef MICRO_BENCH_METADATA_MAX
+  #define MICRO_BENCH_METADATA_MAX 32
+#endif
+#ifndef MICRO_BENCH_METADATA_KEY
+  #define MICRO_BENCH_METADATA_KEY 32
+#endif
+#ifndef MICRO_BENCH_METADATA_VALUE
+  #define MICRO_BENCH_METADATA_VALUE 96
+#endif
+
+// Config: Enable the built-in suites and tools
+// They target Linux and use pthreads, so link with `-pthread` on
+// older C libraries. Include this header before any system header,
+// or define _GNU_SOURCE yourself.
+//
+//   #define MICRO_BENCH_SUITES
+
+// Config: Enable lock contention profiling
+// Wait and hold times are recorded per call site through explicit
+// wrappers such as `micro_bench_mutex_lock`. Define
+// MICRO_BENCH_LOCK_WRAP as well to profile unmodified code by linking
+// with:
+//
+//   -Wl,--wrap=pthread_mutex_lock,--wrap=pthread_mutex_unlock
+//   -Wl,--wrap=pthread_rwlock_rdlock,--wrap=pthread_rwlock_wrlock
+//   -Wl,--wrap=pthread_rwlock_unlock,--wrap=pthread_cond_wait
+//
+//   #define MICRO_BENCH_LOCK_PROFILE
+
+// Config: Maximum number of lock sites tracked by the lock profiler
+#ifndef MICRO_BENCH_LOCK_SITES
+  #define MICRO_BENCH_LOCK_SITES 64
+#endif
+
+// Config: Maximum number of profiled locks held at once by a thread
+#ifndef MICRO_BENCH_LOCK_MAX_HELD
+  #define MICRO_BENCH_LOCK_MAX_HELD 16
+#endif
+
+// Config: Maximum length of a benchmarked command after parameter
+// substitution
+#ifndef MICRO_BENCH_COMMAND_MAX
+  #define MICRO_BENCH_COMMAND_MAX 1024
+#endif
+
+// Config: Maximum number of alternative versions registered in the
+// data movement suite
+#ifndef MICRO_BENCH_MEM_IMPLS
+  #define MICRO_BENCH_MEM_IMPLS 16
+#endif
+
+// Config: Number of worst interruptions kept per CPU by the OS noise
+// profiler
+#ifndef MICRO_BENCH_OSNOISE_WORST
+  #define MICRO_BENCH_OSNOISE_WORST 8
+#endif
+
 //
 // Types
 //
 
+#if defined(MICRO_BENCH_LOCK_WRAP) && !defined(MICRO_BENCH_LOCK_PROFILE)
+#define MICRO_BENCH_LOCK_PROFILE
+#endif
+#if defined(MICRO_BENCH_SUITES) || defined(MICRO_BENCH_LOCK_PROFILE)
+  #if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+  #endif
+  #ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+  #endif
+#endif
 #ifndef _POSIX_C_SOURCE
 #define _POSIX_C_SOURCE 199309L
 #endif
+// Anonymous and huge page mappings of the buffer allocator
+#if defined(__linux__) && !defined(_GNU_SOURCE) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
 #ifdef _WIN32
 #error "TODO: support for windows clock"
 #endif
   
 #include <time.h>
+#include <stdint.h>
+
+// Running statistics of a single quantity, updated with Welford's
+// online algorithm like the real and cpu times below
+typedef struct {
+  double min, max, sum, mean;
+  double M2, variance;
+  long unsigned int count;
+} MicroBenchStat;
 
 // Data recorded
 //  
@@ -124,6 +228,14 @@ typedef struct {
   double M2_cpu, M2_real;
   double variance_cpu, variance_real;
   long unsigned int iterations;
+  // Breakdown of real time from the scheduler statistics, only
+  // recorded with `micro_bench_schedstat_enable`
+  MicroBenchStat on_cpu;     // running on a CPU
+  MicroBenchStat run_queue;  // runnable, waiting for a CPU
+  MicroBenchStat blocked;    // sleeping or waiting for I/O
+  long unsigned int timeslices;
+  // Bytes processed, see `micro_bench_add_bytes`
+  uint64_t bytes;
 } MicroBenchData;
 
 // A reporter handles output of data
@@ -133,13 +245,258 @@ typedef struct {
 //(see below).
 typedef void (*MicroBenchReporter)(MicroBenchData *data);
 
+// Latency histogram
+//
+// Durations are recorded in nanoseconds into logarithmic buckets,
+// each power of two is split in 8 linear sub-buckets so percentiles
+// are accurate within 12.5%.
+#define MICRO_BENCH_HISTOGRAM_BUCKETS 496
+typedef struct {
+  uint64_t count;
+  uint64_t min, max;
+  double sum;
+  uint64_t buckets[MICRO_BENCH_HISTOGRAM_BUCKETS];
+} MicroBenchHistogram;
+
+// Trend detection
+//
+// Tracks how the real time of each sample evolves during a run, to
+// detect drift such as thermal throttling. A linear regression of
+// latency against elapsed time is updated on each stop, and the mean
+// of the first and last [window] samples are compared. Attach it to
+// a benchmark with `micro_bench_trend_enable`.
+typedef struct {
+  // Settings
+  unsigned int window;   // samples in the first and last window
+  double threshold;      // relative delta considered drift (0.05 = 5%)
+  int stop_on_drift;     // make `micro_bench_should_stop` return 1
+  double cooldown;       // seconds to pause after a drifting sample
+  // Results
+  double slope;          // seconds of latency per second elapsed
+  double first_mean, last_mean;
+  double delta;          // (last_mean - first_mean) / first_mean
+  int drifting;
+  // Internal state
+  struct timespec origin;
+  double sum_t, sum_y, sum_tt, sum_ty;
+  long unsigned int n;
+  double first_sum, last_sum;
+  double last[MICRO_BENCH_TREND_MAX_WINDOW];
+} MicroBenchTrend;
+
+// Benchmark buffers
+//
+// Input buffers allocated with `micro_bench_alloc` are placed and
+// faulted in outside of the timed region, so that results do not
+// depend on whether pages were touched or backed by huge pages.
+#define MICRO_BENCH_ALLOC_PREFAULT (1 << 0)  // touch every page
+#define MICRO_BENCH_ALLOC_LOCK     (1 << 1)  // mlock the pages
+#define MICRO_BENCH_ALLOC_THP      (1 << 2)  // transparent huge pages
+#define MICRO_BENCH_ALLOC_HUGETLB  (1 << 3)  // MAP_HUGETLB, or THP
+#define MICRO_BENCH_ALLOC_NODE     (1 << 4)  // bind to NUMA `node`
+
+typedef struct {
+  size_t alignment;      // power of two, default 64
+  size_t offset;         // bytes added to the aligned address
+  unsigned int flags;    // MICRO_BENCH_ALLOC_* flags
+  int node;              // NUMA node, with MICRO_BENCH_ALLOC_NODE
+} MicroBenchAllocOptions;
+
+// An allocation tracked by a benchmark
+typedef struct MicroBenchBuffer {
+  void *ptr;             // address returned to the user
+  size_t size;
+  void *map;             // underlying mapping
+  size_t map_size;
+  unsigned int flags;    // flags that were actually applied
+  struct MicroBenchBuffer *next;
+} MicroBenchBuffer;
+
+// Alignment sweep
+//
+// Reruns a body with its buffers at each offset from a 64 byte
+// alignment, and optionally straddling a 4 KiB page boundary, to
+// find the placements a kernel is sensitive to. When both buffers
+// move, every pair of source and destination offsets is tried, so
+// that their relative misalignment is covered. Buffers come from
+// `micro_bench_alloc`.
+#define MICRO_BENCH_SWEEP_SRC (1 << 0)  // move the source buffer
+#define MICRO_BENCH_SWEEP_DST (1 << 1)  // move the destination buffer
+
+typedef void (*MicroBenchSweepFn)(void *dst, void *src, size_t size,
+                                  void *arg);
+
+typedef struct {
+  size_t src_offset, dst_offset;  // bytes from the alignment
+  MicroBenchData data;            // one sample per [repeat] calls
+} MicroBenchSweepPoint;
+
+typedef struct {
+  // Settings, leave a field zero to use its default
+  size_t size;            // bytes passed to the body, default 4096
+  size_t max_offset;      // offsets 0 to max_offset - 1, default 64
+  size_t step;            // between offsets, default 1, or 8 when
+                          // both buffers move
+  unsigned int which;     // MICRO_BENCH_SWEEP_* flags, default both
+  int page_cross;         // also sweep offsets across a page end
+  unsigned int samples;   // samples per offset, default 32
+  unsigned int repeat;    // calls per sample, default 64
+  // Results
+  unsigned int calls;     // calls per sample that were made
+  MicroBenchSweepPoint *points;
+  size_t point_count;
+  size_t best, worst;     // indexes in [points], by mean time
+} MicroBenchSweep;
+
 // A micro benchmark
 typedef struct {
   MicroBenchData data;
   clock_t start_time_cpu;
   struct timespec start_time_real;
+  MicroBenchTrend *trend;   // optional, see `micro_bench_trend_enable`
+  int schedstat;            // see `micro_bench_schedstat_enable`
+  uint64_t start_sched[3];  // run time, run queue time, timeslices
+  uint64_t schedstat_cost;  // on-CPU ns of a read, from calibration
+  MicroBenchBuffer *buffers; // see `micro_bench_alloc`
 } MicroBench;
 
+// Body of a benchmark run in a separate process, it should call
+// `micro_bench_start` and `micro_bench_stop` on [mb]
+typedef void (*MicroBenchBodyFn)(MicroBench *mb, void *arg);
+
+// Layout randomization
+//
+// Results shift by a few percent with the link order, the size of
+// the environment or the heap layout. Each layout runs the body in a
+// forked child with a random stack offset, environment size and heap
+// start offset, so that this bias shows up as spread across layouts
+// rather than as a false difference between two runs.
+typedef struct {
+  // Settings, leave a field zero to use its default
+  unsigned int layouts;    // number of children, default 16
+  uint64_t seed;           // default 1, recorded in the metadata
+  size_t max_stack_pad;    // bytes, default 4096
+  size_t max_env_pad;      // bytes, default 4096
+  size_t max_heap_pad;     // bytes, default 65536
+  // Results
+  MicroBenchStat means;    // mean real time of each layout
+  MicroBenchData data;     // samples of all the layouts
+  unsigned int failed;     // children that did not report
+} MicroBenchLayouts;
+
+// ISA variants
+//
+// Several versions of the same kernel, each built for an instruction
+// set (with `__attribute__((target("avx2")))` or in a separate file).
+// Only the versions supported by the CPU run. Wide vector units can
+// lower the core clock for a while after use, a short scalar probe
+// timed before and right after each variant shows this slowdown.
+#define MICRO_BENCH_ISA_SSE2     (1u << 0)
+#define MICRO_BENCH_ISA_SSE4_2   (1u << 1)
+#define MICRO_BENCH_ISA_AVX      (1u << 2)
+#define MICRO_BENCH_ISA_AVX2     (1u << 3)
+#define MICRO_BENCH_ISA_FMA      (1u << 4)
+#define MICRO_BENCH_ISA_AVX512F  (1u << 5)
+#define MICRO_BENCH_ISA_AVX512BW (1u << 6)
+#define MICRO_BENCH_ISA_AVX512VL (1u << 7)
+
+typedef struct {
+  // Settings
+  const char *name;
+  unsigned int isa;        // MICRO_BENCH_ISA_ features it needs
+  MicroBenchBodyFn fn;
+  void *arg;
+  // Results
+  int skipped;             // the CPU lacks one of the features
+  MicroBenchData data;
+  double probe_before;     // scalar probe time in seconds
+  double probe_after;      // the same probe right after the variant
+} MicroBenchVariant;
+
+// Input patterns
+//
+// Fixed inputs let the branch predictor learn the benchmark. These
+// patterns are generated before the timed region from a seed, the
+// branch on `value < MICRO_BENCH_PATTERN_SPLIT` is taken about half
+// of the time for all of them.
+typedef enum {
+  MICRO_BENCH_PATTERN_SORTED = 0,  // ascending random values
+  MICRO_BENCH_PATTERN_RANDOM,      // uniform random values
+  MICRO_BENCH_PATTERN_PERIODIC,    // a random block of [period] values
+  MICRO_BENCH_PATTERN_ADVERSARIAL, // short runs of random length
+  MICRO_BENCH_PATTERNS,
+} MicroBenchPattern;
+
+#define MICRO_BENCH_PATTERN_SPLIT 0x80000000u
+// Workload generators
+//
+// Key streams with realistic distributions, generated into a buffer
+// of `micro_bench_alloc` before the timed region so that the random
+// number generator stays out of the measurement.
+typedef enum {
+  MICRO_BENCH_KEYS_UNIFORM = 0,
+  MICRO_BENCH_KEYS_ZIPF,         // rank r drawn with weight 1 / r^skew
+  MICRO_BENCH_KEYS_HOTSPOT,      // a hot set gets most of the accesses
+  MICRO_BENCH_KEYS_LATEST,       // Zipf over the most recent keys
+  MICRO_BENCH_KEYS_SEQUENTIAL,   // 0, 1, 2, ... wrapping at [keys]
+} MicroBenchKeyDist;
+
+typedef struct {
+  // Leave a field zero to use its default
+  MicroBenchKeyDist dist;
+  uint64_t keys;          // key space [0, keys), default 1 << 20
+  double skew;            // Zipf exponent in (0, 1), default 0.99
+  int scramble;           // spread the popular Zipf keys with a hash
+  double hot_fraction;    // hotspot: share of hot keys, default 0.2
+  double hot_access;      // hotspot: share of hot accesses, default 0.8
+  uint64_t seed;          // default 1
+} MicroBenchWorkload;
+
+// Capture and replay
+//
+// Inputs recorded from real traffic, to benchmark a function on the
+// distribution it sees in production. The capture side serializes a
+// sample of the calls with a user function into a binary file, the
+// replay side maps the file and feeds each record back to the same
+// function under a MicroBench. Records are a 32 bit length and 4
+// reserved bytes followed by the data, padded to 8 bytes so that
+// they can be read in place.
+
+// Write [input] to [out], at most [capacity] bytes. Returns the
+// number of bytes written, or 0 to skip the call.
+typedef size_t (*MicroBenchSerializeFn)(void *out, size_t capacity,
+                                        const void *input);
+// Run the function under test on a record of [size] bytes
+typedef void (*MicroBenchReplayFn)(const void *record, size_t size,
+                                   void *arg);
+
+typedef struct {
+  // Settings, leave a field zero to use its default
+  MicroBenchSerializeFn serialize;
+  double sample;          // fraction of the calls recorded, default 1
+  size_t max_record;      // bytes, default 4096
+  uint64_t seed;          // sampling, default 1
+  // Results
+  uint64_t calls;         // calls seen by `micro_bench_capture`
+  uint64_t recorded;
+  uint64_t bytes;         // written to the file, with the headers
+  // Internal state, not thread safe: use one capture per thread
+  void *file;
+  unsigned char *scratch;
+  uint64_t state, threshold;
+} MicroBenchCapture;
+
+typedef struct {
+  // Settings, leave a field zero to use its default
+  unsigned int batch;     // records per sample, default 1
+  unsigned int passes;    // times the whole file is replayed, default 1
+  // Results
+  uint64_t records;       // records in the file
+  uint64_t bytes;         // record bytes, without the headers
+  // Internal state
+  unsigned char *map;
+  size_t map_size;
+} MicroBenchReplay;
 //
 // Function declarations
 //
@@ -153,9 +510,43 @@ MICRO_BENCH_DEF void micro_bench_start(MicroBench *mb);
 // Stop a benchmark  
 MICRO_BENCH_DEF void micro_bench_stop(MicroBench *mb);
 
+// Prepare [mb] for its first use, the same as zero initializing it
+MICRO_BENCH_DEF void micro_bench_init(MicroBench *mb);
+
 // Reset internal benchmark data captured so far
+//
+// Attached features such as trend detection and the buffers of
+// `micro_bench_alloc` are kept. [mb] must have been initialized.
 MICRO_BENCH_DEF void micro_bench_clear(MicroBench *mb);
 
+// Allocate a buffer of [size] bytes for the data of [mb]
+//
+// The address is aligned to [options]->alignment, plus
+// [options]->offset bytes. A NULL [options] gives 64 byte alignment
+// with prefaulted pages. Huge pages, locking and NUMA binding are
+// best effort, see `micro_bench_buffer_flags`. Returns NULL on error.
+MICRO_BENCH_DEF void *micro_bench_alloc(MicroBench *mb, size_t size,
+                                        const MicroBenchAllocOptions *options);
+// Returns the MICRO_BENCH_ALLOC_* flags applied to the buffer at
+// [ptr], or 0 if it does not belong to [mb]
+MICRO_BENCH_DEF unsigned int micro_bench_buffer_flags(MicroBench *mb,
+                                                      void *ptr);
+// Release the buffers allocated for [mb]
+MICRO_BENCH_DEF void micro_bench_teardown(MicroBench *mb);
+
+// Split real time into on-CPU, run queue wait and blocked time
+//
+// The scheduler statistics of the calling thread are read from
+// /proc/thread-self/schedstat right before the clocks start and
+// right after they stop. The on-CPU time of a read, calibrated here,
+// is subtracted. Linux only, returns 0 on success and -1 if the
+// statistics are not available.
+MICRO_BENCH_DEF int micro_bench_schedstat_enable(MicroBench *mb);
+
+// Returns 1 if an attached feature asks to end the run early, for
+// example when drift is detected with `stop_on_drift` set
+MICRO_BENCH_DEF int micro_bench_should_stop(MicroBench *mb);
+
 // Getters for either real time and cpu time
 MICRO_BENCH_DEF double micro_bench_get_min_real(MicroBench *mb);
 MICRO_BENCH_DEF double micro_bench_get_min_cpu(MicroBench *mb);
@@ -168,6 +559,27 @@ MICRO_BENCH_DEF double micro_bench_get_sum_cpu(MicroBench *mb);
 MICRO_BENCH_DEF double micro_bench_get_variance_real(MicroBench *mb);
 MICRO_BENCH_DEF double micro_bench_get_variance_cpu(MicroBench *mb);
 
+// Count [bytes] processed by the benchmark, to report throughput
+MICRO_BENCH_DEF void micro_bench_add_bytes(MicroBench *mb, uint64_t bytes);
+// Bytes processed per second of real time
+MICRO_BENCH_DEF double micro_bench_get_bytes_per_second(MicroBench *mb);
+
+// Report metadata
+//
+// Key value pairs describing the conditions of a run, such as the
+// NUMA placement or the seeds of generated inputs. They are global
+// and printed by the default stdout reporter.
+
+// Set [key] to a printf formatted value, replacing the previous one
+MICRO_BENCH_DEF void micro_bench_metadata_set(const char *key,
+                                              const char *fmt, ...);
+// Returns the value of [key], or NULL if it is not set
+MICRO_BENCH_DEF const char *micro_bench_metadata_get(const char *key);
+// Remove all the metadata
+MICRO_BENCH_DEF void micro_bench_metadata_clear(void);
+// Print all the metadata, one "key: value" per line
+MICRO_BENCH_DEF void micro_bench_metadata_report(void);
+
 // Print recorded information to stdout in a nice box
 MICRO_BENCH_DEF void
 micro_bench_default_reporter_stdout(MicroBenchData *data);
@@ -175,6 +587,125 @@ micro_bench_default_reporter_stdout(MicroBenchData *data);
 MICRO_BENCH_DEF void
 micro_bench_default_reporter_csv(MicroBenchData *data);
 
+// Initialize [trend] with [window] samples per window and a relative
+// drift [threshold]. Early stop and cool-down are disabled, set
+// `stop_on_drift` and `cooldown` afterwards to enable them.
+MICRO_BENCH_DEF void micro_bench_trend_init(MicroBenchTrend *trend,
+                                            unsigned int window,
+                                            double threshold);
+// Attach [trend] to [mb], it will be updated on each stop
+MICRO_BENCH_DEF void micro_bench_trend_enable(MicroBench *mb,
+                                              MicroBenchTrend *trend);
+// Print slope, first and last window means and a drift warning
+MICRO_BENCH_DEF void micro_bench_trend_report(MicroBenchTrend *trend);
+
+// Add a sample [x] to [stat]
+MICRO_BENCH_DEF void micro_bench_stat_add(MicroBenchStat *stat, double x);
+
+// Current time of the benchmark clock, in nanoseconds
+MICRO_BENCH_DEF uint64_t micro_bench_time_ns(void);
+
+// Reset [hist] to an empty histogram
+MICRO_BENCH_DEF void micro_bench_histogram_clear(MicroBenchHistogram *hist);
+// Record a duration of [ns] nanoseconds
+MICRO_BENCH_DEF void micro_bench_histogram_add(MicroBenchHistogram *hist,
+                                               uint64_t ns);
+// Add all the samples of [src] to [dst]
+MICRO_BENCH_DEF void
+micro_bench_histogram_merge(MicroBenchHistogram *dst,
+                            MicroBenchHistogram *src);
+// Estimate the [p]-th percentile, with [p] between 0 and 100
+MICRO_BENCH_DEF uint64_t
+micro_bench_histogram_percentile(MicroBenchHistogram *hist, double p);
+// Print percentiles and the non empty buckets of [hist]
+MICRO_BENCH_DEF void
+micro_bench_histogram_report(MicroBenchHistogram *hist, const char *title);
+
+// Add all the samples of [src] to [dst], for example to combine the
+// per thread statistics of a multi-threaded benchmark
+MICRO_BENCH_DEF void micro_bench_stat_merge(MicroBenchStat *dst,
+                                            MicroBenchStat *src);
+MICRO_BENCH_DEF void micro_bench_data_merge(MicroBenchData *dst,
+                                            MicroBenchData *src);
+
+// Run [fn] with [arg] at each offset of [sweep]. Returns 0 on
+// success, -1 on error. Free the results with `micro_bench_sweep_free`.
+MICRO_BENCH_DEF int micro_bench_sweep_offsets(MicroBenchSweep *sweep,
+                                              MicroBenchSweepFn fn,
+                                              void *arg);
+// Print the time per call at each offset, and the worst case
+MICRO_BENCH_DEF void micro_bench_sweep_report(MicroBenchSweep *sweep);
+MICRO_BENCH_DEF void micro_bench_sweep_free(MicroBenchSweep *sweep);
+
+// Returns the next number of a splitmix64 sequence, advancing
+// [state]. Fast and reproducible from a seed, not for cryptography.
+MICRO_BENCH_DEF uint64_t micro_bench_random(uint64_t *state);
+
+// Run [fn] with [arg] once per layout of [layouts], each in a forked
+// child. Returns 0 if at least one layout reported, -1 otherwise.
+MICRO_BENCH_DEF int micro_bench_run_layouts(MicroBenchLayouts *layouts,
+                                            MicroBenchBodyFn fn,
+                                            void *arg);
+// Print the distribution of the mean across layouts
+MICRO_BENCH_DEF void micro_bench_layouts_report(MicroBenchLayouts *layouts);
+
+// Returns the MICRO_BENCH_ISA_ features supported by the CPU and
+// enabled by the operating system, 0 on non x86 hosts
+MICRO_BENCH_DEF unsigned int micro_bench_isa_supported(void);
+// Run each of the [count] [variants] that the CPU supports, in
+// order. Returns the number of variants run.
+MICRO_BENCH_DEF size_t micro_bench_run_variants(MicroBenchVariant *variants,
+                                               size_t count);
+// Print the time of each variant, its speedup over the first one
+// that ran, and the scalar slowdown it left behind
+MICRO_BENCH_DEF void micro_bench_variants_report(MicroBenchVariant *variants,
+                                                 size_t count);
+
+// Fill [values] with [count] numbers following [pattern], from
+// [seed]. [period] is only used by MICRO_BENCH_PATTERN_PERIODIC.
+// The seed is recorded in the report metadata.
+MICRO_BENCH_DEF void micro_bench_pattern_fill(uint32_t *values, size_t count,
+                                              MicroBenchPattern pattern,
+                                              size_t period, uint64_t seed);
+MICRO_BENCH_DEF const char *micro_bench_pattern_name(MicroBenchPattern pattern);
+
+// Generate [count] keys of [workload] in a buffer owned by [mb],
+// released by `micro_bench_teardown`. The distribution and seed are
+// recorded in the report metadata. Returns NULL on error.
+MICRO_BENCH_DEF uint64_t *micro_bench_workload(MicroBench *mb,
+                                               MicroBenchWorkload *workload,
+                                               size_t count);
+
+// Record the milestone [name] of a program started by
+// `micro_bench_startup_run`, such as "main" at the top of main or
+// "ready" once it can serve. Does nothing otherwise.
+MICRO_BENCH_DEF void micro_bench_startup_mark(const char *name);
+
+// Create the capture file at [path] and start recording with the
+// settings of [capture]. Returns 0 on success, -1 on error.
+MICRO_BENCH_DEF int micro_bench_capture_open(MicroBenchCapture *capture,
+                                             const char *path);
+// Record [input] with the sampling probability of [capture]. Call it
+// at the top of the function under test.
+MICRO_BENCH_DEF void micro_bench_capture(MicroBenchCapture *capture,
+                                         const void *input);
+// Flush and close the file. Returns 0 on success, -1 on error.
+MICRO_BENCH_DEF int micro_bench_capture_close(MicroBenchCapture *capture);
+
+// Map the capture file at [path] and check its records. Returns 0
+// on success, -1 on error. A file cut short by a crash is replayed
+// up to its last complete record.
+MICRO_BENCH_DEF int micro_bench_replay_open(MicroBenchReplay *replay,
+                                            const char *path);
+// Call [fn] with [arg] on every record, timing each batch of records
+// as one sample of [mb] and counting the record bytes. Returns the
+// number of records replayed.
+MICRO_BENCH_DEF uint64_t micro_bench_replay_run(MicroBenchReplay *replay,
+                                                MicroBench *mb,
+                                                MicroBenchReplayFn fn,
+                                                void *arg);
+MICRO_BENCH_DEF void micro_bench_replay_close(MicroBenchReplay *replay);
+
 // Report benchmark data with the default stdout reporter
 MICRO_BENCH_DEF void micro_bench_report(MicroBench *mb);
 // Report benchmark data with a specific [reporter]
@@ -182,6 +713,544 @@ MICRO_BENCH_DEF void
 micro_bench_report_with(MicroBench *mb,
                         MicroBenchReporter reporter);
 
+//
+// Lock profiling
+//
+
+#ifdef MICRO_BENCH_LOCK_PROFILE
+
+#include <pthread.h>
+
+typedef enum {
+  MICRO_BENCH_LOCK_MUTEX = 0,
+  MICRO_BENCH_LOCK_RDLOCK,
+  MICRO_BENCH_LOCK_WRLOCK,
+  MICRO_BENCH_LOCK_COND,
+} MicroBenchLockKind;
+
+// Statistics of a lock site
+//
+// A site is identified by the source location of an explicit
+// wrapper, or by the caller address when the pthread functions are
+// wrapped by the linker. Times are in seconds, histograms in
+// nanoseconds. For condition variables, wait is the time spent in
+// `pthread_cond_wait`.
+typedef struct {
+  const char *file;
+  int line;
+  const void *caller;
+  MicroBenchLockKind kind;
+  uint64_t acquisitions;
+  uint64_t contended;        // acquisitions that had to block
+  MicroBenchStat wait;
+  MicroBenchStat hold;
+  MicroBenchHistogram wait_histogram;
+  MicroBenchHistogram hold_histogram;
+  // Internal state
+  unsigned char busy;        // spinlock protecting the statistics
+  unsigned char used;
+} MicroBenchLockSite;
+
+// Explicit wrappers, use them in place of the pthread functions to
+// record wait and hold times at each call site
+#define micro_bench_mutex_lock(m) \
+  micro_bench_mutex_lock_at((m), __FILE__, __LINE__)
+#define micro_bench_rwlock_rdlock(l) \
+  micro_bench_rwlock_rdlock_at((l), __FILE__, __LINE__)
+#define micro_bench_rwlock_wrlock(l) \
+  micro_bench_rwlock_wrlock_at((l), __FILE__, __LINE__)
+#define micro_bench_cond_wait(c, m) \
+  micro_bench_cond_wait_at((c), (m), __FILE__, __LINE__)
+
+MICRO_BENCH_DEF int micro_bench_mutex_lock_at(pthread_mutex_t *mutex,
+                                              const char *file,
+                                              int line);
+MICRO_BENCH_DEF int micro_bench_mutex_unlock(pthread_mutex_t *mutex);
+MICRO_BENCH_DEF int micro_bench_rwlock_rdlock_at(pthread_rwlock_t *rwlock,
+                                                 const char *file,
+                                                 int line);
+MICRO_BENCH_DEF int micro_bench_rwlock_wrlock_at(pthread_rwlock_t *rwlock,
+                                                 const char *file,
+                                                 int line);
+MICRO_BENCH_DEF int micro_bench_rwlock_unlock(pthread_rwlock_t *rwlock);
+MICRO_BENCH_DEF int micro_bench_cond_wait_at(pthread_cond_t *cond,
+                                             pthread_mutex_t *mutex,
+                                             const char *file,
+                                             int line);
+
+// Fill [sites] with up to [max] lock sites sorted by total wait
+// time, longest first. Returns the number of sites written.
+MICRO_BENCH_DEF int micro_bench_lock_sites(MicroBenchLockSite *sites,
+                                           int max);
+// Print the lock sites sorted by total wait time
+MICRO_BENCH_DEF void micro_bench_lock_report(void);
+// Forget all the lock sites recorded so far. Do not call this while
+// other threads are holding instrumented locks.
+MICRO_BENCH_DEF void micro_bench_lock_clear(void);
+
+#endif // MICRO_BENCH_LOCK_PROFILE
+
+//
+// Suites and tools
+//
+
+#ifdef MICRO_BENCH_SUITES
+
+// Per CPU results of the OS noise profiler
+typedef struct {
+  int cpu;
+  uint64_t runtime_ns;       // time spent sampling the clock
+  uint64_t noise_ns;         // time lost in interruptions
+  uint64_t interruptions;
+  uint64_t worst[MICRO_BENCH_OSNOISE_WORST];  // longest gaps, descending
+  MicroBenchHistogram histogram;              // gap durations
+} MicroBenchOsnoise;
+
+// Fill [cpus] with the CPUs this process may run on, up to [max].
+// Returns the number of CPUs found.
+MICRO_BENCH_DEF int micro_bench_cpu_list(int *cpus, int max);
+// Pin the calling thread to [cpu]. Returns 0 on success, -1 on error.
+MICRO_BENCH_DEF int micro_bench_pin_cpu(int cpu);
+
+// OS noise profiler
+//
+// Spins on each CPU for [duration] seconds reading the benchmark
+// clock in a tight loop, in the spirit of osnoise and hwlatdetect.
+// Every gap between two reads longer than [threshold_ns] is recorded
+// as an interruption. Results for up to [max] CPUs are written to
+// [results]. Returns the number of CPUs sampled, or -1 on error.
+MICRO_BENCH_DEF int micro_bench_osnoise_run(double duration,
+                                            uint64_t threshold_ns,
+                                            MicroBenchOsnoise *results,
+                                            int max);
+// Print interruption counts, worst gaps and histograms per CPU
+MICRO_BENCH_DEF void micro_bench_osnoise_report(MicroBenchOsnoise *results,
+                                                int count);
+
+
+// Multi-threaded runner
+//
+// Runs the same body on several threads that start at the same time.
+// Each thread owns a MicroBench and a histogram to record samples
+// without sharing, merge them afterwards with `micro_bench_data_merge`
+// and `micro_bench_histogram_merge`.
+typedef struct MicroBenchThread {
+  int index;                      // from 0 to count - 1
+  int count;                      // number of threads in the run
+  int cpu;                        // pinned CPU, or -1
+  int node;                       // bound NUMA node, or -1
+  MicroBench mb;
+  MicroBenchHistogram histogram;
+  uint64_t ops;                   // operations completed by the body
+  // Internal state
+  volatile int *stop;
+} MicroBenchThread;
+
+typedef void (*MicroBenchThreadFn)(MicroBenchThread *thread, void *arg);
+
+// Run [fn] with [arg] on [count] threads, described by [threads].
+// With a positive [duration] in seconds the body should loop while
+// `micro_bench_thread_running` returns 1, otherwise it must return
+// by itself. If [pin] is set threads are pinned round robin to the
+// allowed CPUs. Returns 0 on success, -1 on error.
+MICRO_BENCH_DEF int micro_bench_run_threads(MicroBenchThread *threads,
+                                            int count, double duration,
+                                            int pin, MicroBenchThreadFn fn,
+                                            void *arg);
+// Same as `micro_bench_run_threads`, with the threads pinned round
+// robin to the CPUs of NUMA [node]. The node is recorded in the
+// report metadata as "numa.cpu_node".
+MICRO_BENCH_DEF int micro_bench_run_threads_on_node(MicroBenchThread *threads,
+                                                    int count,
+                                                    double duration,
+                                                    int node,
+                                                    MicroBenchThreadFn fn,
+                                                    void *arg);
+// Returns 0 once the duration of the run has elapsed
+MICRO_BENCH_DEF int micro_bench_thread_running(MicroBenchThread *thread);
+
+// NUMA
+//
+// Topology is read from /sys/devices/system/node and memory is placed
+// with the mbind system call, no libnuma is needed. On machines with
+// a single node, or without NUMA support, everything is node 0.
+
+// Fill [nodes] with up to [max] online NUMA nodes. Returns their
+// number, at least 1.
+MICRO_BENCH_DEF int micro_bench_numa_nodes(int *nodes, int max);
+// Fill [cpus] with up to [max] CPUs of [node]. Returns their number.
+MICRO_BENCH_DEF int micro_bench_numa_node_cpus(int node, int *cpus, int max);
+// Pin the calling thread to the CPUs of [node]. Returns 0 on success.
+MICRO_BENCH_DEF int micro_bench_numa_bind_thread(int node);
+// Map [size] bytes with their pages on [node], already faulted in.
+// If the memory policy cannot be set the pages are placed by the
+// kernel as usual. Returns NULL on error.
+MICRO_BENCH_DEF void *micro_bench_numa_alloc(size_t size, int node);
+MICRO_BENCH_DEF void micro_bench_numa_free(void *ptr, size_t size);
+// Returns the node holding the page at [ptr], or -1 if unknown
+MICRO_BENCH_DEF int micro_bench_numa_node_of(void *ptr);
+
+// NUMA matrix suite
+//
+// For each pair of CPU node and memory node, measures the latency of
+// a dependent pointer chase and the read bandwidth of a single thread.
+// Leave a field zero to use its default.
+typedef struct {
+  size_t size;           // buffer bytes, default 64 MiB
+  double duration;       // seconds per measurement, default 0.2
+} MicroBenchNumaSuite;
+
+// Print the latency and bandwidth matrices
+MICRO_BENCH_DEF void micro_bench_suite_numa(MicroBenchNumaSuite *suite);
+
+// Lock implementation under test
+//
+// [create] returns a new unlocked lock. [lock] and [unlock] receive a
+// per thread [node] of MICRO_BENCH_LOCK_NODE_SIZE bytes, for queue
+// locks such as MCS.
+#define MICRO_BENCH_LOCK_NODE_SIZE 64
+typedef struct {
+  const char *name;
+  void *(*create)(void);
+  void (*destroy)(void *lock);
+  void (*lock)(void *lock, void *node);
+  void (*unlock)(void *lock, void *node);
+} MicroBenchLockImpl;
+
+// Lock benchmark suite
+//
+// Measures acquire latency, throughput and fairness of each lock for
+// each thread count and critical section length. Leave a field zero
+// to use its default.
+typedef struct {
+  const MicroBenchLockImpl *impls;  // default: built-in locks
+  int impl_count;
+  const int *threads;               // default: 1, 2, 4... up to CPUs
+  int thread_count;
+  const unsigned int *critical;     // loop iterations inside the lock
+  int critical_count;               // default: 0 and 100
+  double duration;                  // seconds per run, default 0.5
+  int pin;
+} MicroBenchLocksSuite;
+
+// pthread mutex, pthread spinlock, test-and-test-and-set spinlock,
+// ticket lock, MCS queue lock and pthread rwlock in write mode
+// Returns them and writes their number to [count].
+MICRO_BENCH_DEF const MicroBenchLockImpl *micro_bench_lock_builtins(int *count);
+// Print the suite results
+MICRO_BENCH_DEF void micro_bench_suite_locks(MicroBenchLocksSuite *suite);
+
+
+// Atomic operations suite
+//
+// Measures the latency and throughput of fetch_add, compare and swap,
+// exchange and fences for each memory order, with all the threads
+// hammering the same variable. It then pairs per thread counters
+// packed in one cache line against padded ones to quantify the cost
+// of false sharing. Leave a field zero to use its default.
+typedef struct {
+  const int *threads;    // default: 1, 2, 4... up to CPUs
+  int thread_count;
+  double duration;       // seconds per run, default 0.2
+  int pin;
+} MicroBenchAtomicsSuite;
+
+// Print the suite results
+MICRO_BENCH_DEF void micro_bench_suite_atomics(MicroBenchAtomicsSuite *suite);
+
+
+// Memory bandwidth suite
+//
+// STREAM-like kernels (copy, scale, add, triad, plus read-only and
+// write-only with non-temporal stores) over three arrays of doubles
+// split among the threads. Each configuration runs with pages first
+// touched by the workers, so that they are local to them, and by
+// the main thread, so that they are all on its node. The workers are
+// always pinned in the first case, first touch placement means
+// nothing if they can move. Leave a field zero to use its default.
+typedef struct {
+  size_t size;           // bytes per array, default 64 MiB
+  const int *threads;    // default: 1, 2, 4... up to CPUs
+  int thread_count;
+  double duration;       // seconds per kernel, default 0.5
+  int pin;               // also pin with the main thread placement
+} MicroBenchStreamSuite;
+
+// Print the suite results
+MICRO_BENCH_DEF void micro_bench_suite_stream(MicroBenchStreamSuite *suite);
+
+
+// Data movement suite
+//
+// Baselines for memcpy, memmove, memset, memcmp and strlen over sizes
+// from 1 byte to 64 MiB, hot (the same buffer every call) and cold
+// (a new region of pools sized against the last level cache every
+// call). Alternative versions can be registered with
+// `micro_bench_mem_register` and are reported side by side with the
+// C library. Throughput counts [size] bytes per call, memcmp compares
+// equal buffers.
+typedef enum {
+  MICRO_BENCH_MEMCPY = 0,
+  MICRO_BENCH_MEMMOVE,
+  MICRO_BENCH_MEMSET,
+  MICRO_BENCH_MEMCMP,
+  MICRO_BENCH_STRLEN,
+  MICRO_BENCH_MEM_KINDS,
+} MicroBenchMemKind;
+
+// An implementation of one of the functions, set the member that
+// matches [kind]
+typedef struct {
+  const char *name;
+  MicroBenchMemKind kind;
+  void *(*copy)(void *dst, const void *src, size_t n);  // memcpy, memmove
+  void *(*set)(void *dst, int c, size_t n);
+  int (*compare)(const void *a, const void *b, size_t n);
+  size_t (*length)(const char *s);
+} MicroBenchMemImpl;
+
+typedef struct {
+  size_t min_size;       // default 1
+  size_t max_size;       // default 64 MiB
+  unsigned int factor;   // size multiplier between steps, default 4
+  double duration;       // seconds per measurement, default 0.05
+} MicroBenchMemSuite;
+
+// Add [impl] to the suite, up to MICRO_BENCH_MEM_IMPLS of them.
+// The struct is copied. Returns 0 on success, -1 if full.
+MICRO_BENCH_DEF int micro_bench_mem_register(const MicroBenchMemImpl *impl);
+// Print ns per call and GB/s for every function, size and version
+MICRO_BENCH_DEF void micro_bench_suite_mem(MicroBenchMemSuite *suite);
+
+
+// Branch prediction suite
+//
+// Time a data dependent branch over each input pattern and estimate
+// the misprediction penalty of the host, with the branch misses from
+// the hardware counters when perf_event_open is allowed.
+typedef struct {
+  size_t count;          // values per pass, default 65536
+  size_t periods[8];     // periodic pattern periods, default 4, 64, 4096
+  uint64_t seed;         // default 1
+  double duration;       // seconds per pattern, default 0.1
+} MicroBenchBranchSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_branch(MicroBenchBranchSuite *suite);
+
+
+// Allocator under test, [ctx] is passed back to both calls
+typedef struct {
+  const char *name;
+  void *(*alloc)(void *ctx, size_t size);
+  void (*release)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} MicroBenchAllocImpl;
+
+// Memory allocator suite
+//
+// For each allocator and thread count: a sweep of allocate and free
+// pairs per size class, producer and consumer pairs of threads where
+// the consumer frees, bursts of allocations freed together, and long
+// lived working sets where random slots are replaced, fragmenting the
+// heap. Reports per operation latency percentiles and the growth of
+// the resident set left after the run. Leave a field zero to use its
+// default.
+typedef struct {
+  const MicroBenchAllocImpl *impls; // default: malloc and free
+  int impl_count;
+  const int *threads;               // default: 1, 2, 4... up to CPUs
+  int thread_count;
+  const size_t *sizes;              // default: 16 B to 64 KiB
+  int size_count;
+  unsigned int burst;               // allocations per burst, default 1024
+  unsigned int live;                // working set slots, default 4096
+  double duration;                  // seconds per run, default 0.2
+  int pin;
+} MicroBenchAllocSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_alloc(MicroBenchAllocSuite *suite);
+
+
+// Where the two sides of a ping-pong run
+typedef enum {
+  MICRO_BENCH_PLACE_ANY = 0,       // not pinned
+  MICRO_BENCH_PLACE_SAME_CPU,      // both on one CPU
+  MICRO_BENCH_PLACE_SMT_SIBLING,   // two hardware threads of one core
+  MICRO_BENCH_PLACE_OTHER_CORE,    // two cores of one package
+  MICRO_BENCH_PLACE_OTHER_SOCKET,  // two packages
+  MICRO_BENCH_PLACES,
+} MicroBenchPlacement;
+
+// Find two allowed CPUs with the given [placement]. Returns 0 and
+// writes them to [a] and [b], or -1 if the host has no such pair.
+// MICRO_BENCH_PLACE_ANY gives -1 for both.
+MICRO_BENCH_DEF int micro_bench_cpu_pair(MicroBenchPlacement placement,
+                                         int *a, int *b);
+
+// Syscall and context switch suite
+//
+// Cost of cheap system calls and sched_yield on one thread, and round
+// trips of futex, pipe and eventfd ping-pong between two threads or
+// two processes for each placement. Leave a field zero to use its
+// default.
+typedef struct {
+  unsigned int iterations;              // per measurement, default 20000
+  const MicroBenchPlacement *placements; // default: all of them
+  int placement_count;
+} MicroBenchSyscallSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_syscall(MicroBenchSyscallSuite *suite);
+
+
+// Timer wake-up suite
+//
+// Requests wake-ups at fixed intervals with nanosleep, absolute
+// clock_nanosleep and a periodic timerfd, under SCHED_OTHER and
+// SCHED_FIFO, and measures how late each wake-up is against the
+// intended time, in the style of cyclictest. SCHED_FIFO needs
+// CAP_SYS_NICE, without it those rows are reported as not permitted.
+// Leave a field zero to use its default.
+typedef struct {
+  const uint64_t *intervals;  // ns, default 100 us and 1 ms
+  int interval_count;
+  unsigned int wakeups;       // per measurement, default 1000
+  int priority;               // SCHED_FIFO priority, default 50
+  int pin;                    // run on the first allowed CPU
+} MicroBenchTimerSuite;
+
+// Print a summary table and the latency histogram of each run
+MICRO_BENCH_DEF void micro_bench_suite_timer(MicroBenchTimerSuite *suite);
+
+
+// File I/O suite
+//
+// Generates a file and reads it sequentially and at random block
+// offsets with read, pread, mmap, O_DIRECT and io_uring (when the
+// kernel allows it, at several queue depths), with the page cache
+// warm and dropped. Reports per operation latency percentiles and
+// MB/s from the byte counters. Methods the kernel or the file system
+// do not support are reported as not available. Leave a field zero to
+// use its default.
+typedef struct {
+  const char *path;             // default "micro-bench-io.tmp"
+  size_t file_size;             // default 256 MiB
+  const size_t *block_sizes;    // default 4 KiB, 64 KiB and 1 MiB
+  int block_size_count;
+  const unsigned int *depths;   // io_uring queue depths, default 1, 16
+  int depth_count;
+  double duration;              // seconds per run, default 0.1
+  uint64_t seed;                // random offsets, default 1
+  int keep;                     // do not remove the file at the end
+} MicroBenchIoSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_io(MicroBenchIoSuite *suite);
+
+
+// Loopback networking suite
+//
+// Round trip latency (ping-pong) and one way throughput (streaming)
+// over loopback TCP with and without TCP_NODELAY, UDP, and Unix
+// stream and datagram sockets, for each message size. The client and
+// server threads are placed with a MicroBenchPlacement. Streaming
+// reports the time of each send and the rate seen by the receiver,
+// datagrams dropped by the kernel are not counted. Leave a field
+// zero to use its default.
+typedef struct {
+  const size_t *sizes;            // default 64 B, 1 KiB, 16 KiB, 64 KiB
+  int size_count;
+  unsigned int iterations;        // ping-pong round trips, default 10000
+  double duration;                // streaming seconds, default 0.2
+  MicroBenchPlacement placement;  // default MICRO_BENCH_PLACE_ANY
+} MicroBenchNetSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_net(MicroBenchNetSuite *suite);
+
+
+// Shared memory IPC suite
+//
+// Two forked processes exchange messages over single producer single
+// consumer rings in a shared mapping. The consumer either polls, or
+// sleeps on a futex or an eventfd and is woken by the producer. One
+// way latency compares the timestamp counters of both processes, so
+// their skew is measured first and reported. Leave a field zero to
+// use its default.
+typedef struct {
+  const size_t *sizes;            // default 8 B, 256 B, 4 KiB, 64 KiB
+  int size_count;
+  double duration;                // seconds per run, default 0.2
+  MicroBenchPlacement placement;  // default MICRO_BENCH_PLACE_ANY
+} MicroBenchShmSuite;
+
+MICRO_BENCH_DEF void micro_bench_suite_shm(MicroBenchShmSuite *suite);
+
+
+// Command benchmarking
+//
+// Runs a shell command several times, like hyperfine. Wall time goes
+// to a MicroBench, so the usual reporters apply, with the CPU time of
+// the child from wait4 in place of the CPU time of the caller. The
+// prepare and cleanup commands run around every run, untimed, and
+// the run stops if one of them fails. "{name}" in the commands is replaced by the value of "name=value"
+// in [params]. Leave a field zero to use its default.
+typedef struct {
+  // Settings
+  const char *command;            // run with /bin/sh -c
+  const char *prepare;            // optional
+  const char *cleanup;            // optional
+  const char *const *params;      // "name=value" substitutions
+  int param_count;
+  unsigned int runs;              // default 10
+  unsigned int warmup;            // untimed runs first, default 0
+  int show_output;                // output goes to /dev/null otherwise
+  // Results
+  char expanded[MICRO_BENCH_COMMAND_MAX];  // command after substitution
+  MicroBench mb;                  // wall time and child CPU time
+  MicroBenchStat user, sys;       // child CPU seconds
+  MicroBenchStat max_rss;         // KiB
+  MicroBenchStat minor_faults, major_faults;
+  unsigned int failed;            // runs with a non zero exit status
+} MicroBenchCommand;
+
+// Run [cmd]. Returns 0 if every run started, -1 otherwise or if a
+// prepare or cleanup command exited with a non zero status.
+MICRO_BENCH_DEF int micro_bench_command_run(MicroBenchCommand *cmd);
+// Print the MicroBench report followed by the resource usage
+MICRO_BENCH_DEF void micro_bench_command_report(MicroBenchCommand *cmd);
+// Print mean wall time of each command relative to the fastest
+MICRO_BENCH_DEF void micro_bench_command_compare(MicroBenchCommand *cmds,
+                                                 int count);
+
+
+// Process startup breakdown
+//
+// Runs a program several times and splits its startup into phases
+// between milestones: the exec (taken by the runner just before
+// execv), the "constructor" mark of MICRO_BENCH_STARTUP, and the
+// marks of `micro_bench_startup_mark` in the program, up to the exit
+// seen by the runner. It also compares the time to the last mark with
+// lazy binding and with LD_BIND_NOW, and reads the loader and
+// relocation cycles from LD_DEBUG=statistics of dynamic executables.
+#define MICRO_BENCH_STARTUP_MARKS 8
+typedef struct {
+  // Settings
+  char *const *argv;              // program and arguments, no shell
+  unsigned int runs;              // per mode, default 20
+  // Results, times in seconds
+  int mark_count;                 // milestones seen, with "exec" first
+  char marks[MICRO_BENCH_STARTUP_MARKS][64];
+  MicroBenchStat phases[MICRO_BENCH_STARTUP_MARKS]; // mark i to i + 1,
+                                                    // the last to exit
+  MicroBenchStat lazy, bind_now;  // exec to the last mark
+  MicroBenchStat loader, relocation; // cycles, from ld.so
+  unsigned int failed;
+} MicroBenchStartup;
+
+// Run the measurements. Returns 0 on success, -1 on error.
+MICRO_BENCH_DEF int micro_bench_startup_run(MicroBenchStartup *startup);
+MICRO_BENCH_DEF void micro_bench_startup_report(MicroBenchStartup *startup);
+
+#endif // MICRO_BENCH_SUITES
+
 //
 // Implementation
 //
@@ -189,15 +1258,201 @@ micro_bench_report_with(MicroBench *mb,
 #ifdef MICRO_BENCH_IMPLEMENTATION
 
 #include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+#ifndef __GNUC__
+#include <alloca.h>
+#endif
+
+// USDT probes
+//
+// Each probe is a nop and an ELF note with its address and where to
+// find the arguments, which the tracer patches when it attaches:
+//
+//   bpftrace -e 'usdt:./bench:micro_bench:stop { @ns = hist(arg1); }'
+//
+// The arguments are the benchmark (or the lock) and a duration in
+// nanoseconds.
+#if defined(MICRO_BENCH_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MICRO_BENCH_PROBE(name, a, b) DTRACE_PROBE2(micro_bench, name, a, b)
+#endif
+#endif
+#if defined(MICRO_BENCH_USDT) && !defined(MICRO_BENCH_PROBE) \
+  && defined(__GNUC__) && defined(__ELF__) \
+  && (defined(__x86_64__) || defined(__aarch64__))
+// The note layout of SystemTap, version 3, as written by <sys/sdt.h>
+#define MICRO_BENCH_PROBE(name, a, b)                                   \
+  __asm__ __volatile__(                                                 \
+    "990: nop\n"                                                        \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                       \
+    ".balign 4\n"                                                       \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                  \
+    "991: .asciz \"stapsdt\"\n"                                         \
+    "992: .balign 4\n"                                                  \
+    "993: .8byte 990b\n"                                                \
+    ".8byte _.stapsdt.base\n"                                           \
+    ".8byte 0\n"                                                        \
+    ".asciz \"micro_bench\"\n"                                          \
+    ".asciz \"" #name "\"\n"                                            \
+    ".asciz \"8@%0 8@%1\"\n"                                            \
+    "994: .balign 4\n"                                                  \
+    ".popsection\n"                                                     \
+    ".ifndef _.stapsdt.base\n"                                          \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                            \
+    ".hidden _.stapsdt.base\n"                                          \
+    "_.stapsdt.base: .space 1\n"                                        \
+    ".size _.stapsdt.base, 1\n"                                         \
+    ".popsection\n"                                                     \
+    ".endif\n"                                                          \
+    :: "r"((uint64_t)(uintptr_t)(a)), "r"((uint64_t)(b)))
+#endif
+#ifndef MICRO_BENCH_PROBE
+#define MICRO_BENCH_PROBE(name, a, b) ((void)0)
+#endif
+
+static double micro_bench_abs(double x)
+{
+  return (x < 0) ? -x : x;
+}
+
+// Add a sample of [y] seconds, started at [start], to the trend
+static void micro_bench_trend_update(MicroBenchTrend *trend,
+                                     struct timespec *start,
+                                     double y)
+{
+  if (trend->n == 0)
+    trend->origin = *start;
+  double t = (start->tv_sec - trend->origin.tv_sec)
+    + (start->tv_nsec - trend->origin.tv_nsec) / 1e9;
+
+  trend->n++;
+  trend->sum_t += t;
+  trend->sum_y += y;
+  trend->sum_tt += t * t;
+  trend->sum_ty += t * y;
+
+  double n = (double)trend->n;
+  double den = n * trend->sum_tt - trend->sum_t * trend->sum_t;
+  if (trend->n > 1 && den != 0.0)
+    trend->slope = (n * trend->sum_ty - trend->sum_t * trend->sum_y) / den;
+
+  unsigned int window = trend->window;
+  if (window == 0 || window > MICRO_BENCH_TREND_MAX_WINDOW)
+    window = MICRO_BENCH_TREND_MAX_WINDOW;
+
+  if (trend->n <= window)
+    trend->first_sum += y;
+
+  // The last window is a ring buffer of the most recent samples
+  unsigned int slot = (unsigned int)((trend->n - 1) % window);
+  if (trend->n > window)
+    trend->last_sum -= trend->last[slot];
+  trend->last[slot] = y;
+  trend->last_sum += y;
+
+  // Windows must not overlap to give a meaningful delta
+  if (trend->n < 2 * (long unsigned int)window)
+    return;
+
+  trend->first_mean = trend->first_sum / window;
+  trend->last_mean = trend->last_sum / window;
+  if (trend->first_mean > 0.0)
+    trend->delta = (trend->last_mean - trend->first_mean) / trend->first_mean;
+  trend->drifting = micro_bench_abs(trend->delta) > trend->threshold;
+
+  if (trend->drifting && trend->cooldown > 0.0)
+  {
+    struct timespec pause;
+    pause.tv_sec = (time_t)trend->cooldown;
+    pause.tv_nsec = (long)((trend->cooldown - (double)pause.tv_sec) * 1e9);
+    nanosleep(&pause, NULL);
+  }
+  return;
+}
+
+// Read run time, run queue time and timeslices of the calling thread.
+// Returns 0 on success, -1 on error.
+static int micro_bench_schedstat_read(uint64_t out[3])
+{
+#ifdef __linux__
+  // The run time is only brought up to date by scheduler events, or by
+  // reading the CPU clock of the thread
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  FILE *f = fopen("/proc/thread-self/schedstat", "r");
+  if (!f) f = fopen("/proc/self/schedstat", "r");
+  if (!f) return -1;
+  unsigned long long v[3];
+  int n = fscanf(f, "%llu %llu %llu", &v[0], &v[1], &v[2]);
+  fclose(f);
+  if (n != 3) return -1;
+  out[0] = v[0];
+  out[1] = v[1];
+  out[2] = v[2];
+  return 0;
+#else
+  (void)out;
+  return -1;
+#endif
+}
 
 MICRO_BENCH_DEF void micro_bench_start(MicroBench *mb)
 {
   if (!mb) return;
+  if (mb->schedstat)
+    micro_bench_schedstat_read(mb->start_sched);
+  MICRO_BENCH_PROBE(start, mb, 0);
   mb->start_time_cpu = clock();
   clock_gettime(CLOCK_MONOTONIC, &mb->start_time_real);
   return;
 }
 
+// Add a sample of [cpu] and [real] seconds to [data]
+static void micro_bench_data_add(MicroBenchData *data, double cpu, double real)
+{
+  if (cpu < data->min_cpu || data->min_cpu == 0.0)
+    data->min_cpu = cpu;
+  if (real < data->min_real || data->min_real == 0.0)
+    data->min_real = real;
+  if (cpu > data->max_cpu)
+    data->max_cpu = cpu;
+  if (real > data->max_real)
+    data->max_real = real;
+
+  data->sum_cpu += cpu;
+  data->sum_real += real;
+  data->iterations++;
+
+  // Welford's online algorithm to calculate variance
+  double delta_cpu = cpu - data->mean_cpu;
+  data->mean_cpu += delta_cpu / data->iterations;
+  double delta2_cpu = cpu - data->mean_cpu;
+  data->M2_cpu += delta_cpu * delta2_cpu;
+  data->variance_cpu = data->M2_cpu / data->iterations;
+  
+  double delta_real = real - data->mean_real;
+  data->mean_real += delta_real / data->iterations;
+  double delta2_real = real - data->mean_real;
+  data->M2_real += delta_real * delta2_real;
+  data->variance_real = data->M2_real / data->iterations;
+  return;
+}
+
 MICRO_BENCH_DEF void micro_bench_stop(MicroBench *mb)
 {
   if (!mb) return;
@@ -205,51 +1460,236 @@ MICRO_BENCH_DEF void micro_bench_stop(MicroBench *mb)
   double stop_time_cpu = clock();
   struct timespec stop_time_real;
   clock_gettime(CLOCK_MONOTONIC, &stop_time_real);
+  uint64_t stop_sched[3];
+  int sched = mb->schedstat && micro_bench_schedstat_read(stop_sched) == 0;
   double diff_cpu = (double)(stop_time_cpu - mb->start_time_cpu) / CLOCKS_PER_SEC;
   double diff_real = (stop_time_real.tv_sec - mb->start_time_real.tv_sec)
     + (stop_time_real.tv_nsec - mb->start_time_real.tv_nsec) / 1e9;
 
-  if (diff_cpu < mb->data.min_cpu || mb->data.min_cpu == 0.0)
-    mb->data.min_cpu = diff_cpu;
-  if (diff_real < mb->data.min_real || mb->data.min_real == 0.0)
-    mb->data.min_real = diff_real;
-  if (diff_cpu > mb->data.max_cpu)
-    mb->data.max_cpu = diff_cpu;
-  if (diff_real > mb->data.max_real)
-    mb->data.max_real = diff_real;
+  MICRO_BENCH_PROBE(stop, mb,
+                    (stop_time_real.tv_sec - mb->start_time_real.tv_sec)
+                    * 1000000000ll
+                    + (stop_time_real.tv_nsec - mb->start_time_real.tv_nsec));
 
-  mb->data.sum_cpu += diff_cpu;
-  mb->data.sum_real += diff_real;
-  mb->data.iterations++;
+  micro_bench_data_add(&mb->data, diff_cpu, diff_real);
 
-  // Welford's online algorithm to calculate variance
-  double delta_cpu = diff_cpu - mb->data.mean_cpu;
-  mb->data.mean_cpu += delta_cpu / mb->data.iterations;
-  double delta2_cpu = diff_cpu - mb->data.mean_cpu;
-  mb->data.M2_cpu += delta_cpu * delta2_cpu;
-  mb->data.variance_cpu = mb->data.M2_cpu / mb->data.iterations;
-  
-  double delta_real = diff_real - mb->data.mean_real;
-  mb->data.mean_real += delta_real / mb->data.iterations;
-  double delta2_real = diff_real - mb->data.mean_real;
-  mb->data.M2_real += delta_real * delta2_real;
-  mb->data.variance_real = mb->data.M2_real / mb->data.iterations;
+  if (mb->trend)
+    micro_bench_trend_update(mb->trend, &mb->start_time_real, diff_real);
+
+  if (sched)
+  {
+    // The window of the statistics still includes the end of one read
+    // and the start of the other
+    uint64_t run = stop_sched[0] - mb->start_sched[0];
+    run = run > mb->schedstat_cost ? run - mb->schedstat_cost : 0;
+    double on_cpu = run / 1e9;
+    if (on_cpu > diff_real) on_cpu = diff_real;
+    double run_queue = (stop_sched[1] - mb->start_sched[1]) / 1e9;
+    if (run_queue > diff_real - on_cpu) run_queue = diff_real - on_cpu;
+    double blocked = diff_real - on_cpu - run_queue;
+    micro_bench_stat_add(&mb->data.on_cpu, on_cpu);
+    micro_bench_stat_add(&mb->data.run_queue, run_queue);
+    micro_bench_stat_add(&mb->data.blocked, blocked);
+    mb->data.timeslices += stop_sched[2] - mb->start_sched[2];
+  }
   
   return;
 }
 
-MICRO_BENCH_DEF void micro_bench_clear(MicroBench *mb)
+MICRO_BENCH_DEF void micro_bench_init(MicroBench *mb)
 {
   if (!mb) return;
-  mb->data = (MicroBenchData){0};
-  mb->start_time_cpu = (clock_t){0};
-  mb->start_time_real = (struct timespec){0};
+  memset(mb, 0, sizeof(*mb));
   return;
 }
 
-MICRO_BENCH_DEF double micro_bench_get_min_real(MicroBench *mb)
+MICRO_BENCH_DEF void micro_bench_clear(MicroBench *mb)
 {
-  return mb->data.min_real;
+  if (!mb) return;
+  memset(&mb->data, 0, sizeof(mb->data));
+  memset(&mb->start_time_cpu, 0, sizeof(mb->start_time_cpu));
+  memset(&mb->start_time_real, 0, sizeof(mb->start_time_real));
+  memset(mb->start_sched, 0, sizeof(mb->start_sched));
+  return;
+}
+
+#define MICRO_BENCH_MPOL_BIND 2
+#define MICRO_BENCH_MPOL_F_NODE (1 << 0)
+#define MICRO_BENCH_MPOL_F_ADDR (1 << 1)
+#define MICRO_BENCH_MAX_NODES 1024
+
+// Bind the pages of a mapping to [node]. Returns 0 on success, -1 on
+// kernels without NUMA support.
+static int micro_bench_mbind(void *ptr, size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+  if (node < 0 || node >= MICRO_BENCH_MAX_NODES) return -1;
+  unsigned long mask[MICRO_BENCH_MAX_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |=
+    1ul << (node % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_mbind, ptr, size, MICRO_BENCH_MPOL_BIND, mask,
+              (unsigned long)MICRO_BENCH_MAX_NODES, 0) != 0)
+    return -1;
+  return 0;
+#else
+  (void)ptr; (void)size; (void)node;
+  return -1;
+#endif
+}
+
+// Map [size] bytes of zeroed private memory
+static void *micro_bench_map(size_t size, int hugetlb)
+{
+#if defined(MAP_ANONYMOUS)
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB)
+  if (hugetlb) flags |= MAP_HUGETLB;
+#else
+  if (hugetlb) return NULL;
+#endif
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+#else
+  if (hugetlb) return NULL;
+  int fd = open("/dev/zero", O_RDWR);
+  if (fd < 0) return NULL;
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+#endif
+  return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+MICRO_BENCH_DEF void *micro_bench_alloc(MicroBench *mb, size_t size,
+                                        const MicroBenchAllocOptions *options)
+{
+  MicroBenchAllocOptions defaults = { 64, 0, MICRO_BENCH_ALLOC_PREFAULT, 0 };
+  if (!mb || size == 0) return NULL;
+  if (!options) options = &defaults;
+  size_t alignment = options->alignment ? options->alignment : 64;
+  if ((alignment & (alignment - 1)) != 0) return NULL;
+
+  MicroBenchBuffer *buf =
+    (MicroBenchBuffer *)calloc(1, sizeof(MicroBenchBuffer));
+  if (!buf) return NULL;
+  buf->size = size;
+  buf->map_size = size + alignment + options->offset;
+
+  if (options->flags & MICRO_BENCH_ALLOC_HUGETLB)
+  {
+    // Huge page mappings must be a multiple of the huge page size
+    size_t huge = (size_t)2 << 20;
+    size_t map_size = (buf->map_size + huge - 1) & ~(huge - 1);
+    buf->map = micro_bench_map(map_size, 1);
+    if (buf->map)
+    {
+      buf->map_size = map_size;
+      buf->flags |= MICRO_BENCH_ALLOC_HUGETLB;
+    }
+  }
+  if (!buf->map)
+    buf->map = micro_bench_map(buf->map_size, 0);
+  if (!buf->map)
+  {
+    free(buf);
+    return NULL;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if ((options->flags & (MICRO_BENCH_ALLOC_THP | MICRO_BENCH_ALLOC_HUGETLB))
+      && !(buf->flags & MICRO_BENCH_ALLOC_HUGETLB)
+      && madvise(buf->map, buf->map_size, MADV_HUGEPAGE) == 0)
+    buf->flags |= MICRO_BENCH_ALLOC_THP;
+#endif
+  // The policy must be set before the pages are faulted in
+  if ((options->flags & MICRO_BENCH_ALLOC_NODE)
+      && micro_bench_mbind(buf->map, buf->map_size, options->node) == 0)
+    buf->flags |= MICRO_BENCH_ALLOC_NODE;
+
+  uintptr_t base = (uintptr_t)buf->map;
+  base = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  buf->ptr = (void *)(base + options->offset);
+
+  if (options->flags & MICRO_BENCH_ALLOC_PREFAULT)
+  {
+    for (size_t i = 0; i < buf->map_size; i += 4096)
+      ((volatile unsigned char *)buf->map)[i] = 0;
+    buf->flags |= MICRO_BENCH_ALLOC_PREFAULT;
+  }
+  if ((options->flags & MICRO_BENCH_ALLOC_LOCK)
+      && mlock(buf->map, buf->map_size) == 0)
+    buf->flags |= MICRO_BENCH_ALLOC_LOCK;
+
+  buf->next = mb->buffers;
+  mb->buffers = buf;
+  return buf->ptr;
+}
+
+MICRO_BENCH_DEF unsigned int micro_bench_buffer_flags(MicroBench *mb,
+                                                      void *ptr)
+{
+  if (!mb) return 0;
+  for (MicroBenchBuffer *buf = mb->buffers; buf; buf = buf->next)
+    if (buf->ptr == ptr)
+      return buf->flags;
+  return 0;
+}
+
+MICRO_BENCH_DEF void micro_bench_teardown(MicroBench *mb)
+{
+  if (!mb) return;
+  MicroBenchBuffer *buf = mb->buffers;
+  while (buf)
+  {
+    MicroBenchBuffer *next = buf->next;
+    munmap(buf->map, buf->map_size);
+    free(buf);
+    buf = next;
+  }
+  mb->buffers = NULL;
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_schedstat_enable(MicroBench *mb)
+{
+  if (!mb) return -1;
+  uint64_t probe[3];
+  if (micro_bench_schedstat_read(probe) != 0)
+    return -1;
+
+  // Run time accounted around an empty sample beyond its real time,
+  // the least of a few tries to leave out preemptions
+  uint64_t cost = UINT64_MAX;
+  for (int i = 0; i < 64; ++i)
+  {
+    uint64_t a[3], b[3];
+    struct timespec t0, t1;
+    if (micro_bench_schedstat_read(a) != 0) return -1;
+    (void)clock();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    (void)clock();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (micro_bench_schedstat_read(b) != 0) return -1;
+    uint64_t real = (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000000ll
+                               + (t1.tv_nsec - t0.tv_nsec));
+    uint64_t extra = b[0] - a[0] > real ? b[0] - a[0] - real : 0;
+    if (extra < cost) cost = extra;
+  }
+  mb->schedstat_cost = cost;
+  mb->schedstat = 1;
+  return 0;
+}
+
+MICRO_BENCH_DEF int micro_bench_should_stop(MicroBench *mb)
+{
+  if (!mb) return 0;
+  if (mb->trend && mb->trend->stop_on_drift && mb->trend->drifting)
+    return 1;
+  return 0;
+}
+
+MICRO_BENCH_DEF double micro_bench_get_min_real(MicroBench *mb)
+{
+  return mb->data.min_real;
 }
   
 MICRO_BENCH_DEF double micro_bench_get_min_cpu(MicroBench *mb)
@@ -297,6 +1737,72 @@ MICRO_BENCH_DEF double micro_bench_get_variance_cpu(MicroBench *mb)
   return mb->data.variance_cpu;
 }
 
+MICRO_BENCH_DEF void micro_bench_add_bytes(MicroBench *mb, uint64_t bytes)
+{
+  if (!mb) return;
+  mb->data.bytes += bytes;
+  return;
+}
+
+MICRO_BENCH_DEF double micro_bench_get_bytes_per_second(MicroBench *mb)
+{
+  if (mb->data.sum_real <= 0.0) return 0.0;
+  return (double)mb->data.bytes / mb->data.sum_real;
+}
+
+static struct {
+  char key[MICRO_BENCH_METADATA_KEY];
+  char value[MICRO_BENCH_METADATA_VALUE];
+} micro_bench_metadata[MICRO_BENCH_METADATA_MAX];
+static int micro_bench_metadata_count;
+
+MICRO_BENCH_DEF void micro_bench_metadata_set(const char *key,
+                                              const char *fmt, ...)
+{
+  if (!key || !fmt) return;
+  int i = 0;
+  for (; i < micro_bench_metadata_count; ++i)
+    if (strncmp(micro_bench_metadata[i].key, key,
+                MICRO_BENCH_METADATA_KEY - 1) == 0)
+      break;
+  if (i == MICRO_BENCH_METADATA_MAX) return;
+  if (i == micro_bench_metadata_count)
+  {
+    snprintf(micro_bench_metadata[i].key, MICRO_BENCH_METADATA_KEY, "%s", key);
+    micro_bench_metadata_count++;
+  }
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(micro_bench_metadata[i].value, MICRO_BENCH_METADATA_VALUE,
+            fmt, args);
+  va_end(args);
+  return;
+}
+
+MICRO_BENCH_DEF const char *micro_bench_metadata_get(const char *key)
+{
+  if (!key) return NULL;
+  for (int i = 0; i < micro_bench_metadata_count; ++i)
+    if (strncmp(micro_bench_metadata[i].key, key,
+                MICRO_BENCH_METADATA_KEY - 1) == 0)
+      return micro_bench_metadata[i].value;
+  return NULL;
+}
+
+MICRO_BENCH_DEF void micro_bench_metadata_clear(void)
+{
+  micro_bench_metadata_count = 0;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_metadata_report(void)
+{
+  for (int i = 0; i < micro_bench_metadata_count; ++i)
+    printf("%s: %s\n", micro_bench_metadata[i].key,
+           micro_bench_metadata[i].value);
+  return;
+}
+
 MICRO_BENCH_DEF void
 micro_bench_default_reporter_stdout(MicroBenchData *data)
 {
@@ -313,7 +1819,25 @@ micro_bench_default_reporter_stdout(MicroBenchData *data)
   printf("|   var    |  %1.7f   |  %1.7f  |\n", data->variance_real, data->variance_cpu);
   printf("|---------------------------------------|\n");
   printf("|   iterations   |    %9ld         |\n", data->iterations);
+  if (data->bytes > 0 && data->sum_real > 0.0)
+    printf("|   throughput   |  %9.3f GB/s      |\n",
+           (double)data->bytes / data->sum_real / 1e9);
+  if (data->on_cpu.count > 0)
+  {
+    printf("|---------------------------------------|\n");
+    printf("|  sched   |     mean     |     max     |\n");
+    printf("|---------------------------------------|\n");
+    printf("|  on-CPU  |  %1.7f   |  %1.7f  |\n",
+           data->on_cpu.mean, data->on_cpu.max);
+    printf("| runqueue |  %1.7f   |  %1.7f  |\n",
+           data->run_queue.mean, data->run_queue.max);
+    printf("| blocked  |  %1.7f   |  %1.7f  |\n",
+           data->blocked.mean, data->blocked.max);
+    printf("|---------------------------------------|\n");
+    printf("|   timeslices   |    %9lu         |\n", data->timeslices);
+  }
   printf("\\---------------------------------------/\n");
+  micro_bench_metadata_report();
   return;
 }
 
@@ -328,20 +1852,5747 @@ micro_bench_default_reporter_csv(MicroBenchData *data)
   return;
 }
   
-MICRO_BENCH_DEF void micro_bench_report(MicroBench *mb)
+MICRO_BENCH_DEF void micro_bench_trend_init(MicroBenchTrend *trend,
+                                            unsigned int window,
+                                            double threshold)
 {
-  micro_bench_report_with(mb, micro_bench_default_reporter_stdout);
+  if (!trend) return;
+  memset(trend, 0, sizeof(*trend));
+  if (window == 0 || window > MICRO_BENCH_TREND_MAX_WINDOW)
+    window = MICRO_BENCH_TREND_MAX_WINDOW;
+  trend->window = window;
+  trend->threshold = threshold;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_trend_enable(MicroBench *mb,
+                                              MicroBenchTrend *trend)
+{
+  if (!mb) return;
+  mb->trend = trend;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_trend_report(MicroBenchTrend *trend)
+{
+  if (!trend) return;
+  printf("\n");
+  printf("/---------------------------------------\\\n");
+  printf("|          Trend detection report       |\n");
+  printf("|---------------------------------------|\n");
+  printf("|   slope      |  %+1.7f s/s        |\n", trend->slope);
+  printf("|   first mean |  %1.7f             |\n", trend->first_mean);
+  printf("|   last mean  |  %1.7f             |\n", trend->last_mean);
+  printf("|   delta      |  %+8.3f %%            |\n", trend->delta * 100.0);
+  printf("|---------------------------------------|\n");
+  printf("|   samples    |  %9lu             |\n", trend->n);
+  printf("\\---------------------------------------/\n");
+  if (trend->n < 2 * (long unsigned int)trend->window)
+    printf("Not enough samples to compare windows of %u\n", trend->window);
+  else if (trend->drifting)
+    printf("WARNING: latency drifted by %+.2f%% during the run (threshold %.2f%%)\n",
+           trend->delta * 100.0, trend->threshold * 100.0);
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_stat_add(MicroBenchStat *stat, double x)
+{
+  if (!stat) return;
+  if (x < stat->min || stat->count == 0)
+    stat->min = x;
+  if (x > stat->max)
+    stat->max = x;
+  stat->sum += x;
+  stat->count++;
+
+  double delta = x - stat->mean;
+  stat->mean += delta / stat->count;
+  double delta2 = x - stat->mean;
+  stat->M2 += delta * delta2;
+  stat->variance = stat->M2 / stat->count;
+  return;
+}
+
+MICRO_BENCH_DEF uint64_t micro_bench_time_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int micro_bench_log2(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(v);
+#else
+  int r = 0;
+  while (v >>= 1) r++;
+  return r;
+#endif
+}
+
+static int micro_bench_histogram_index(uint64_t ns)
+{
+  if (ns < 8) return (int)ns;
+  int b = micro_bench_log2(ns);
+  return (b - 2) * 8 + (int)((ns >> (b - 3)) & 7);
+}
+
+static uint64_t micro_bench_histogram_lower(int index)
+{
+  if (index < 8) return (uint64_t)index;
+  int b = index / 8 + 2;
+  return (uint64_t)(8 + index % 8) << (b - 3);
+}
+
+static uint64_t micro_bench_histogram_width(int index)
+{
+  if (index < 8) return 1;
+  return (uint64_t)1 << (index / 8 - 1);
+}
+
+MICRO_BENCH_DEF void micro_bench_histogram_clear(MicroBenchHistogram *hist)
+{
+  if (!hist) return;
+  memset(hist, 0, sizeof(*hist));
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_histogram_add(MicroBenchHistogram *hist,
+                                               uint64_t ns)
+{
+  if (!hist) return;
+  if (ns < hist->min || hist->count == 0)
+    hist->min = ns;
+  if (ns > hist->max)
+    hist->max = ns;
+  hist->count++;
+  hist->sum += (double)ns;
+  hist->buckets[micro_bench_histogram_index(ns)]++;
   return;
 }
 
 MICRO_BENCH_DEF void
-micro_bench_report_with(MicroBench *mb,
-                        MicroBenchReporter reporter)
+micro_bench_histogram_merge(MicroBenchHistogram *dst,
+                            MicroBenchHistogram *src)
 {
-  reporter(&mb->data);
+  if (!dst || !src || src->count == 0) return;
+  if (src->min < dst->min || dst->count == 0)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for (int i = 0; i < MICRO_BENCH_HISTOGRAM_BUCKETS; ++i)
+    dst->buckets[i] += src->buckets[i];
+  return;
+}
+
+MICRO_BENCH_DEF uint64_t
+micro_bench_histogram_percentile(MicroBenchHistogram *hist, double p)
+{
+  if (!hist || hist->count == 0) return 0;
+  if (p <= 0.0) return hist->min;
+  if (p >= 100.0) return hist->max;
+
+  double rank = p / 100.0 * (double)hist->count;
+  uint64_t seen = 0;
+  for (int i = 0; i < MICRO_BENCH_HISTOGRAM_BUCKETS; ++i)
+  {
+    if (hist->buckets[i] == 0) continue;
+    if ((double)(seen + hist->buckets[i]) >= rank)
+    {
+      // Interpolate linearly inside the bucket
+      double frac = (rank - (double)seen) / (double)hist->buckets[i];
+      uint64_t v = micro_bench_histogram_lower(i)
+        + (uint64_t)(frac * (double)micro_bench_histogram_width(i));
+      if (v < hist->min) v = hist->min;
+      if (v > hist->max) v = hist->max;
+      return v;
+    }
+    seen += hist->buckets[i];
+  }
+  return hist->max;
+}
+
+MICRO_BENCH_DEF void
+micro_bench_histogram_report(MicroBenchHistogram *hist, const char *title)
+{
+  if (!hist) return;
+  printf("\n");
+  printf("/---------------------------------------\\\n");
+  printf("| %-37.37s |\n", title ? title : "Latency histogram (ns)");
+  printf("|---------------------------------------|\n");
+  printf("|   count    |  %20llu    |\n", (unsigned long long)hist->count);
+  printf("|   min      |  %20llu    |\n", (unsigned long long)hist->min);
+  printf("|   p50      |  %20llu    |\n",
+         (unsigned long long)micro_bench_histogram_percentile(hist, 50.0));
+  printf("|   p90      |  %20llu    |\n",
+         (unsigned long long)micro_bench_histogram_percentile(hist, 90.0));
+  printf("|   p99      |  %20llu    |\n",
+         (unsigned long long)micro_bench_histogram_percentile(hist, 99.0));
+  printf("|   p99.9    |  %20llu    |\n",
+         (unsigned long long)micro_bench_histogram_percentile(hist, 99.9));
+  printf("|   max      |  %20llu    |\n", (unsigned long long)hist->max);
+  printf("|---------------------------------------|\n");
+
+  // One row per power of two
+  for (int b = 0; b < MICRO_BENCH_HISTOGRAM_BUCKETS; b += 8)
+  {
+    uint64_t n = 0;
+    for (int i = b; i < b + 8; ++i)
+      n += hist->buckets[i];
+    if (n == 0) continue;
+    unsigned long long lo = (unsigned long long)micro_bench_histogram_lower(b);
+    int bar = (int)((n * 8 + hist->count - 1) / hist->count);
+    printf("| >= %12llu | %10llu |%-8.*s|\n", lo, (unsigned long long)n,
+           bar, "########");
+  }
+  printf("\\---------------------------------------/\n");
+  return;
+}
+
+// Combine two sets of Welford statistics, with Chan's parallel
+// algorithm. Returns the merged mean and M2 through [mean] and [M2].
+static void micro_bench_welford_merge(double *mean, double *M2,
+                                      long unsigned int n_dst,
+                                      double mean_src, double M2_src,
+                                      long unsigned int n_src)
+{
+  double n = (double)n_dst + (double)n_src;
+  double delta = mean_src - *mean;
+  *mean += delta * (double)n_src / n;
+  *M2 += M2_src + delta * delta * (double)n_dst * (double)n_src / n;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_stat_merge(MicroBenchStat *dst,
+                                            MicroBenchStat *src)
+{
+  if (!dst || !src || src->count == 0) return;
+  if (dst->count == 0)
+  {
+    *dst = *src;
+    return;
+  }
+  if (src->min < dst->min) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+  dst->sum += src->sum;
+  micro_bench_welford_merge(&dst->mean, &dst->M2, dst->count,
+                            src->mean, src->M2, src->count);
+  dst->count += src->count;
+  dst->variance = dst->M2 / dst->count;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_data_merge(MicroBenchData *dst,
+                                            MicroBenchData *src)
+{
+  if (!dst || !src || src->iterations == 0) return;
+  if (dst->iterations == 0)
+  {
+    *dst = *src;
+    return;
+  }
+  if (src->min_cpu < dst->min_cpu) dst->min_cpu = src->min_cpu;
+  if (src->min_real < dst->min_real) dst->min_real = src->min_real;
+  if (src->max_cpu > dst->max_cpu) dst->max_cpu = src->max_cpu;
+  if (src->max_real > dst->max_real) dst->max_real = src->max_real;
+  dst->sum_cpu += src->sum_cpu;
+  dst->sum_real += src->sum_real;
+  micro_bench_welford_merge(&dst->mean_cpu, &dst->M2_cpu, dst->iterations,
+                            src->mean_cpu, src->M2_cpu, src->iterations);
+  micro_bench_welford_merge(&dst->mean_real, &dst->M2_real, dst->iterations,
+                            src->mean_real, src->M2_real, src->iterations);
+  dst->iterations += src->iterations;
+  dst->variance_cpu = dst->M2_cpu / dst->iterations;
+  dst->variance_real = dst->M2_real / dst->iterations;
+
+  micro_bench_stat_merge(&dst->on_cpu, &src->on_cpu);
+  micro_bench_stat_merge(&dst->run_queue, &src->run_queue);
+  micro_bench_stat_merge(&dst->blocked, &src->blocked);
+  dst->timeslices += src->timeslices;
+  dst->bytes += src->bytes;
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_sweep_offsets(MicroBenchSweep *sweep,
+                                              MicroBenchSweepFn fn,
+                                              void *arg)
+{
+  if (!sweep || !fn) return -1;
+  micro_bench_sweep_free(sweep);
+  size_t size = sweep->size ? sweep->size : 4096;
+  size_t max_offset = sweep->max_offset ? sweep->max_offset : 64;
+  unsigned int which = sweep->which
+    ? sweep->which : (MICRO_BENCH_SWEEP_SRC | MICRO_BENCH_SWEEP_DST);
+  unsigned int samples = sweep->samples ? sweep->samples : 32;
+  unsigned int repeat = sweep->repeat ? sweep->repeat : 64;
+
+  int both = (which & MICRO_BENCH_SWEEP_SRC) && (which & MICRO_BENCH_SWEEP_DST);
+  size_t step = sweep->step ? sweep->step : (both ? 8 : 1);
+
+  // Offsets of each buffer, the second half starts max_offset / 2
+  // bytes before the first page end past that many bytes
+  size_t per_buffer = (max_offset + step - 1) / step;
+  size_t offset_count = sweep->page_cross ? 2 * per_buffer : per_buffer;
+  size_t cross = 4096 * ((max_offset / 2 + 4095) / 4096) - max_offset / 2;
+  size_t *offsets = (size_t *)malloc(offset_count * sizeof(size_t));
+  if (!offsets) return -1;
+  for (size_t i = 0; i < per_buffer; ++i)
+  {
+    offsets[i] = i * step;
+    if (sweep->page_cross)
+      offsets[per_buffer + i] = cross + i * step;
+  }
+
+  size_t count = both ? offset_count * offset_count : offset_count;
+  sweep->points =
+    (MicroBenchSweepPoint *)calloc(count, sizeof(MicroBenchSweepPoint));
+  if (!sweep->points)
+  {
+    free(offsets);
+    return -1;
+  }
+  sweep->point_count = count;
+
+  // Page aligned buffers, with room for the page crossing offsets
+  MicroBench mb;
+  micro_bench_init(&mb);
+  MicroBenchAllocOptions options = { 4096, 0, MICRO_BENCH_ALLOC_PREFAULT, 0 };
+  size_t room = size + max_offset + 2 * 4096;
+  unsigned char *src = (unsigned char *)micro_bench_alloc(&mb, room, &options);
+  unsigned char *dst = (unsigned char *)micro_bench_alloc(&mb, room, &options);
+  if (!src || !dst)
+  {
+    free(offsets);
+    micro_bench_teardown(&mb);
+    micro_bench_sweep_free(sweep);
+    return -1;
+  }
+  for (size_t i = 0; i < room; ++i)
+    src[i] = (unsigned char)i;
+
+  sweep->best = sweep->worst = 0;
+  for (size_t p = 0; p < count; ++p)
+  {
+    MicroBenchSweepPoint *point = &sweep->points[p];
+    if (both)
+    {
+      point->src_offset = offsets[p / offset_count];
+      point->dst_offset = offsets[p % offset_count];
+    }
+    else
+    {
+      point->src_offset = (which & MICRO_BENCH_SWEEP_SRC) ? offsets[p] : 0;
+      point->dst_offset = (which & MICRO_BENCH_SWEEP_DST) ? offsets[p] : 0;
+    }
+
+    MicroBench run;
+    micro_bench_init(&run);
+    fn(dst + point->dst_offset, src + point->src_offset, size, arg);
+    for (unsigned int s = 0; s < samples; ++s)
+    {
+      micro_bench_start(&run);
+      for (unsigned int r = 0; r < repeat; ++r)
+        fn(dst + point->dst_offset, src + point->src_offset, size, arg);
+      micro_bench_stop(&run);
+    }
+    point->data = run.data;
+
+    if (point->data.mean_real < sweep->points[sweep->best].data.mean_real)
+      sweep->best = p;
+    if (point->data.mean_real > sweep->points[sweep->worst].data.mean_real)
+      sweep->worst = p;
+  }
+  sweep->calls = repeat;
+  free(offsets);
+  micro_bench_teardown(&mb);
+  return 0;
+}
+
+MICRO_BENCH_DEF void micro_bench_sweep_report(MicroBenchSweep *sweep)
+{
+  if (!sweep || !sweep->points) return;
+  double repeat = sweep->calls ? sweep->calls : 1;
+  double best = sweep->points[sweep->best].data.mean_real;
+  printf("\n");
+  printf("/-------------------------------------------------------\\\n");
+  printf("|                 Alignment sweep report                |\n");
+  printf("|-------------------------------------------------------|\n");
+  printf("|   src   |   dst   |  min (ns)  |  mean (ns) |  ratio  |\n");
+  printf("|-------------------------------------------------------|\n");
+  for (size_t p = 0; p < sweep->point_count; ++p)
+  {
+    MicroBenchSweepPoint *point = &sweep->points[p];
+    printf("| %7zu | %7zu | %10.2f | %10.2f | %6.3fx%c|\n",
+           point->src_offset, point->dst_offset,
+           point->data.min_real / repeat * 1e9,
+           point->data.mean_real / repeat * 1e9,
+           best > 0.0 ? point->data.mean_real / best : 0.0,
+           p == sweep->worst ? '*' : ' ');
+  }
+  printf("\\-------------------------------------------------------/\n");
+  MicroBenchSweepPoint *worst = &sweep->points[sweep->worst];
+  printf("* worst case: src +%zu, dst +%zu, %.2fx the best placement\n",
+         worst->src_offset, worst->dst_offset,
+         best > 0.0 ? worst->data.mean_real / best : 0.0);
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_sweep_free(MicroBenchSweep *sweep)
+{
+  if (!sweep) return;
+  free(sweep->points);
+  sweep->points = NULL;
+  sweep->point_count = 0;
+  return;
+}
+
+MICRO_BENCH_DEF uint64_t micro_bench_random(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static double micro_bench_sqrt(double x)
+{
+  if (x <= 0.0) return 0.0;
+  double r = x > 1.0 ? x : 1.0;
+  for (int i = 0; i < 64; ++i)
+    r = 0.5 * (r + x / r);
+  return r;
+}
+
+// Runs in the child, below a stack pad of [stack_pad] bytes
+static void micro_bench_layout_child(MicroBenchBodyFn fn, void *arg,
+                                     size_t stack_pad, int fd)
+{
+  // Released on return, so it stays below the frames of the body
+#ifdef __GNUC__
+  volatile char *pad = (volatile char *)__builtin_alloca(stack_pad + 1);
+#else
+  volatile char *pad = (volatile char *)alloca(stack_pad + 1);
+#endif
+  pad[0] = 0;
+  pad[stack_pad] = 0;
+
+  MicroBench mb;
+  micro_bench_init(&mb);
+  fn(&mb, arg);
+  micro_bench_teardown(&mb);
+
+  const char *p = (const char *)&mb.data;
+  size_t left = sizeof(mb.data);
+  while (left > 0)
+  {
+    ssize_t n = write(fd, p, left);
+    if (n <= 0) break;
+    p += n;
+    left -= (size_t)n;
+  }
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_run_layouts(MicroBenchLayouts *layouts,
+                                            MicroBenchBodyFn fn,
+                                            void *arg)
+{
+  if (!layouts || !fn) return -1;
+  unsigned int count = layouts->layouts ? layouts->layouts : 16;
+  uint64_t seed = layouts->seed ? layouts->seed : 1;
+  size_t max_stack = layouts->max_stack_pad ? layouts->max_stack_pad : 4096;
+  size_t max_env = layouts->max_env_pad ? layouts->max_env_pad : 4096;
+  size_t max_heap = layouts->max_heap_pad ? layouts->max_heap_pad : 65536;
+  memset(&layouts->means, 0, sizeof(layouts->means));
+  memset(&layouts->data, 0, sizeof(layouts->data));
+  layouts->failed = 0;
+  micro_bench_metadata_set("layouts.seed", "%llu", (unsigned long long)seed);
+  micro_bench_metadata_set("layouts.count", "%u", count);
+
+  uint64_t state = seed;
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    // Stack pads keep the 16 byte alignment required by the ABI
+    size_t stack_pad = (size_t)(micro_bench_random(&state) % max_stack) & ~(size_t)15;
+    size_t env_pad = (size_t)(micro_bench_random(&state) % max_env);
+    size_t heap_pad = (size_t)(micro_bench_random(&state) % max_heap);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+      layouts->failed++;
+      continue;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(fds[0]);
+      // The environment is copied at exec time, without exec its size
+      // moves the heap. The stack shift it would cause is covered by
+      // the stack pad.
+#if defined(__linux__) || (_POSIX_C_SOURCE >= 200112L)
+      char *env = (char *)malloc(env_pad + 1);
+      if (env)
+      {
+        memset(env, 'x', env_pad);
+        env[env_pad] = '\0';
+        setenv("MICRO_BENCH_LAYOUT_PAD", env, 1);
+        free(env);
+      }
+#endif
+      // Never freed, it moves every following allocation
+      volatile char *heap = (volatile char *)malloc(heap_pad + 1);
+      if (heap) heap[0] = 0;
+      micro_bench_layout_child(fn, arg, stack_pad, fds[1]);
+      close(fds[1]);
+      // _exit skips the stdio buffers of whatever the body printed
+      fflush(stdout);
+      fflush(stderr);
+      _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+      close(fds[0]);
+      layouts->failed++;
+      continue;
+    }
+
+    MicroBenchData data;
+    char *p = (char *)&data;
+    size_t left = sizeof(data);
+    while (left > 0)
+    {
+      ssize_t n = read(fds[0], p, left);
+      if (n <= 0) break;
+      p += n;
+      left -= (size_t)n;
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (left > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+        || data.iterations == 0)
+    {
+      layouts->failed++;
+      continue;
+    }
+    micro_bench_stat_add(&layouts->means, data.mean_real);
+    micro_bench_data_merge(&layouts->data, &data);
+  }
+  return (layouts->means.count > 0) ? 0 : -1;
+}
+
+MICRO_BENCH_DEF void micro_bench_layouts_report(MicroBenchLayouts *layouts)
+{
+  if (!layouts) return;
+  MicroBenchStat *m = &layouts->means;
+  double stddev = micro_bench_sqrt(m->variance);
+  printf("\n");
+  printf("/---------------------------------------\\\n");
+  printf("|         Memory layout report          |\n");
+  printf("|---------------------------------------|\n");
+  printf("|   layouts          |  %9lu       |\n", m->count);
+  printf("|   failed           |  %9u       |\n", layouts->failed);
+  printf("|---------------------------------------|\n");
+  printf("|   min of means     |  %1.7f       |\n", m->min);
+  printf("|   max of means     |  %1.7f       |\n", m->max);
+  printf("|   mean of means    |  %1.7f       |\n", m->mean);
+  printf("|   stddev of means  |  %1.7f       |\n", stddev);
+  printf("|   layout spread    |  %8.3f %%      |\n",
+         m->min > 0.0 ? 100.0 * (m->max - m->min) / m->min : 0.0);
+  printf("|   layout cv        |  %8.3f %%      |\n",
+         m->mean > 0.0 ? 100.0 * stddev / m->mean : 0.0);
+  printf("\\---------------------------------------/\n");
   return;
 }
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define MICRO_BENCH_X86
+#endif
+
+MICRO_BENCH_DEF unsigned int micro_bench_isa_supported(void)
+{
+  unsigned int isa = 0;
+#ifdef MICRO_BENCH_X86
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+  if (d & bit_SSE2) isa |= MICRO_BENCH_ISA_SSE2;
+  if (c & bit_SSE4_2) isa |= MICRO_BENCH_ISA_SSE4_2;
+  if (!(c & bit_OSXSAVE)) return isa;
+
+  // The registers must also be saved by the kernel on context switch
+  unsigned int lo, hi;
+  __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  (void)hi;
+  int ymm = (lo & 0x6) == 0x6;
+  int zmm = ymm && (lo & 0xe0) == 0xe0;
+  if (ymm && (c & bit_AVX)) isa |= MICRO_BENCH_ISA_AVX;
+  if (ymm && (c & bit_FMA)) isa |= MICRO_BENCH_ISA_FMA;
+
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return isa;
+  if (ymm && (b & bit_AVX2)) isa |= MICRO_BENCH_ISA_AVX2;
+  if (zmm && (b & bit_AVX512F)) isa |= MICRO_BENCH_ISA_AVX512F;
+  if (zmm && (b & bit_AVX512BW)) isa |= MICRO_BENCH_ISA_AVX512BW;
+  if (zmm && (b & bit_AVX512VL)) isa |= MICRO_BENCH_ISA_AVX512VL;
+#endif
+  return isa;
+}
+
+// A dependent chain of scalar multiplies, its time follows the core
+// clock. Returns the best of three runs in seconds, short enough to
+// fit in the time the clock stays lowered.
+static double micro_bench_scalar_probe(void)
+{
+  volatile uint64_t seed = 1;
+  double best = 0.0;
+  for (int run = 0; run < 3; ++run)
+  {
+    uint64_t x = seed;
+    uint64_t begin = micro_bench_time_ns();
+    for (int i = 0; i < 10000; ++i)
+      x = x * 6364136223846793005ull + 1;
+    uint64_t end = micro_bench_time_ns();
+    seed = x;
+    double t = (end - begin) / 1e9;
+    if (run == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+MICRO_BENCH_DEF size_t micro_bench_run_variants(MicroBenchVariant *variants,
+                                               size_t count)
+{
+  if (!variants) return 0;
+  unsigned int isa = micro_bench_isa_supported();
+  size_t ran = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    MicroBenchVariant *v = &variants[i];
+    memset(&v->data, 0, sizeof(v->data));
+    v->probe_before = v->probe_after = 0.0;
+    v->skipped = (v->isa & ~isa) != 0 || !v->fn;
+    if (v->skipped) continue;
+
+    // Scalar code for a few milliseconds lets the clock recover from
+    // the previous variant
+    uint64_t idle = micro_bench_time_ns() + 10000000;
+    while (micro_bench_time_ns() < idle)
+      micro_bench_scalar_probe();
+    v->probe_before = micro_bench_scalar_probe();
+
+    MicroBench mb;
+    micro_bench_init(&mb);
+    v->fn(&mb, v->arg);
+    v->probe_after = micro_bench_scalar_probe();
+    micro_bench_teardown(&mb);
+    v->data = mb.data;
+    ran++;
+  }
+  return ran;
+}
+
+MICRO_BENCH_DEF void micro_bench_variants_report(MicroBenchVariant *variants,
+                                                 size_t count)
+{
+  if (!variants) return;
+  double base = 0.0;
+  printf("\n");
+  printf("/-------------------------------------------------------------\\\n");
+  printf("|                    ISA variants report                      |\n");
+  printf("|-------------------------------------------------------------|\n");
+  printf("| variant          |     mean real |  speedup |  scalar after |\n");
+  printf("|-------------------------------------------------------------|\n");
+  for (size_t i = 0; i < count; ++i)
+  {
+    MicroBenchVariant *v = &variants[i];
+    const char *name = v->name ? v->name : "?";
+    if (v->skipped || v->data.iterations == 0)
+    {
+      printf("| %-16.16s |   unsupported |          |               |\n", name);
+      continue;
+    }
+    if (base == 0.0) base = v->data.mean_real;
+    double slowdown = v->probe_before > 0.0
+      ? 100.0 * (v->probe_after - v->probe_before) / v->probe_before : 0.0;
+    printf("| %-16.16s |  %1.10f | %7.3fx | %+11.2f %% |\n", name,
+           v->data.mean_real,
+           v->data.mean_real > 0.0 ? base / v->data.mean_real : 0.0,
+           slowdown);
+  }
+  printf("\\-------------------------------------------------------------/\n");
+  return;
+}
+
+static int micro_bench_compare_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+MICRO_BENCH_DEF void micro_bench_pattern_fill(uint32_t *values, size_t count,
+                                              MicroBenchPattern pattern,
+                                              size_t period, uint64_t seed)
+{
+  if (!values || count == 0) return;
+  uint64_t state = seed;
+  switch (pattern)
+  {
+  case MICRO_BENCH_PATTERN_SORTED:
+    for (size_t i = 0; i < count; ++i)
+      values[i] = (uint32_t)micro_bench_random(&state);
+    qsort(values, count, sizeof(*values), micro_bench_compare_u32);
+    break;
+  case MICRO_BENCH_PATTERN_PERIODIC:
+    if (period == 0) period = 1;
+    for (size_t i = 0; i < count; ++i)
+      values[i] = (i < period) ? (uint32_t)micro_bench_random(&state)
+                               : values[i - period];
+    break;
+  case MICRO_BENCH_PATTERN_ADVERSARIAL:
+    // Runs of one to three equal outcomes: too short for a counter
+    // to settle and too irregular for the history to repeat
+    for (size_t i = 0; i < count;)
+    {
+      uint64_t r = micro_bench_random(&state);
+      size_t run = 1 + (size_t)(r % 3);
+      uint32_t side = (i == 0 || values[i - 1] >= MICRO_BENCH_PATTERN_SPLIT)
+                      ? 0 : MICRO_BENCH_PATTERN_SPLIT;
+      for (; run > 0 && i < count; --run, ++i)
+        values[i] = side | (uint32_t)(micro_bench_random(&state)
+                                      & (MICRO_BENCH_PATTERN_SPLIT - 1));
+    }
+    break;
+  case MICRO_BENCH_PATTERN_RANDOM:
+  default:
+    for (size_t i = 0; i < count; ++i)
+      values[i] = (uint32_t)micro_bench_random(&state);
+    break;
+  }
+  micro_bench_metadata_set("pattern.seed", "%llu", (unsigned long long)seed);
+  return;
+}
+
+MICRO_BENCH_DEF const char *micro_bench_pattern_name(MicroBenchPattern pattern)
+{
+  switch (pattern)
+  {
+  case MICRO_BENCH_PATTERN_SORTED:      return "sorted";
+  case MICRO_BENCH_PATTERN_RANDOM:      return "random";
+  case MICRO_BENCH_PATTERN_PERIODIC:    return "periodic";
+  case MICRO_BENCH_PATTERN_ADVERSARIAL: return "adversarial";
+  default:                              return "?";
+  }
+}
+
+// Natural logarithm and exponential, the library does not link libm
+static double micro_bench_log(double x)
+{
+  if (x <= 0.0) return 0.0;
+  double result = 0.0;
+  while (x >= 2.0) { x *= 0.5; result += 0.69314718055994530942; }
+  while (x < 1.0)  { x *= 2.0; result -= 0.69314718055994530942; }
+  // log(x) = 2 atanh((x - 1) / (x + 1)), |z| <= 1/3
+  double z = (x - 1.0) / (x + 1.0);
+  double z2 = z * z, term = z, sum = 0.0;
+  for (int k = 1; k < 40; k += 2)
+  {
+    sum += term / k;
+    term *= z2;
+  }
+  return result + 2.0 * sum;
+}
+
+static double micro_bench_exp(double x)
+{
+  int k = (int)(x / 0.69314718055994530942);
+  double r = x - k * 0.69314718055994530942;
+  double term = 1.0, sum = 1.0;
+  for (int i = 1; i < 30; ++i)
+  {
+    term *= r / i;
+    sum += term;
+  }
+  for (; k > 0; --k) sum *= 2.0;
+  for (; k < 0; ++k) sum *= 0.5;
+  return sum;
+}
+
+static double micro_bench_pow(double x, double y)
+{
+  return (x > 0.0) ? micro_bench_exp(y * micro_bench_log(x)) : 0.0;
+}
+
+// A uniform double in [0, 1)
+static double micro_bench_random_unit(uint64_t *state)
+{
+  return (micro_bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+MICRO_BENCH_DEF uint64_t *micro_bench_workload(MicroBench *mb,
+                                               MicroBenchWorkload *workload,
+                                               size_t count)
+{
+  MicroBenchWorkload defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  if (!workload) workload = &defaults;
+  uint64_t keys = workload->keys ? workload->keys : ((uint64_t)1 << 20);
+  double skew = (workload->skew > 0.0 && workload->skew < 1.0)
+                ? workload->skew : 0.99;
+  double hot_fraction = workload->hot_fraction > 0.0
+                        ? workload->hot_fraction : 0.2;
+  double hot_access = workload->hot_access > 0.0
+                      ? workload->hot_access : 0.8;
+  uint64_t seed = workload->seed ? workload->seed : 1;
+
+  uint64_t *out =
+    (uint64_t *)micro_bench_alloc(mb, count * sizeof(*out), NULL);
+  if (!out) return NULL;
+
+  // Zipf by the method of Gray et al., also used by YCSB. The zeta
+  // constant is a sum over the whole key space.
+  double zetan = 0.0, alpha = 0.0, eta = 0.0, half = 0.0;
+  if (workload->dist == MICRO_BENCH_KEYS_ZIPF
+      || workload->dist == MICRO_BENCH_KEYS_LATEST)
+  {
+    for (uint64_t i = 1; i <= keys; ++i)
+      zetan += 1.0 / micro_bench_pow((double)i, skew);
+    double zeta2 = 1.0 + 1.0 / micro_bench_pow(2.0, skew);
+    alpha = 1.0 / (1.0 - skew);
+    eta = (1.0 - micro_bench_pow(2.0 / keys, 1.0 - skew))
+          / (1.0 - zeta2 / zetan);
+    half = micro_bench_pow(0.5, skew);
+  }
+
+  uint64_t hot = (uint64_t)(keys * hot_fraction);
+  if (hot == 0) hot = 1;
+  if (hot > keys) hot = keys;
+  uint64_t state = seed;
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint64_t key;
+    switch (workload->dist)
+    {
+    case MICRO_BENCH_KEYS_ZIPF:
+    case MICRO_BENCH_KEYS_LATEST:
+    {
+      double u = micro_bench_random_unit(&state);
+      double uz = u * zetan;
+      if (uz < 1.0) key = 0;
+      else if (uz < 1.0 + half) key = 1;
+      else key = (uint64_t)(keys * micro_bench_pow(eta * u - eta + 1.0, alpha));
+      if (key >= keys) key = keys - 1;
+      if (workload->dist == MICRO_BENCH_KEYS_LATEST)
+        key = keys - 1 - key;
+      else if (workload->scramble)
+      {
+        uint64_t h = key;
+        key = micro_bench_random(&h) % keys;
+      }
+      break;
+    }
+    case MICRO_BENCH_KEYS_HOTSPOT:
+      if (micro_bench_random_unit(&state) < hot_access || hot == keys)
+        key = micro_bench_random(&state) % hot;
+      else
+        key = hot + micro_bench_random(&state) % (keys - hot);
+      break;
+    case MICRO_BENCH_KEYS_SEQUENTIAL:
+      key = i % keys;
+      break;
+    case MICRO_BENCH_KEYS_UNIFORM:
+    default:
+      key = micro_bench_random(&state) % keys;
+      break;
+    }
+    out[i] = key;
+  }
+
+  static const char *names[] = {
+    "uniform", "zipf", "hotspot", "latest", "sequential",
+  };
+  unsigned int dist = (unsigned int)workload->dist;
+  micro_bench_metadata_set("workload.dist", "%s",
+                           dist < 5 ? names[dist] : "uniform");
+  micro_bench_metadata_set("workload.keys", "%llu", (unsigned long long)keys);
+  micro_bench_metadata_set("workload.seed", "%llu", (unsigned long long)seed);
+  // Always set, so that a previous workload does not leave stale values
+  if (workload->dist == MICRO_BENCH_KEYS_ZIPF
+      || workload->dist == MICRO_BENCH_KEYS_LATEST)
+    micro_bench_metadata_set("workload.params", "skew=%g scramble=%d",
+                             skew, workload->scramble != 0);
+  else if (workload->dist == MICRO_BENCH_KEYS_HOTSPOT)
+    micro_bench_metadata_set("workload.params", "hot_fraction=%g hot_access=%g",
+                             hot_fraction, hot_access);
+  else
+    micro_bench_metadata_set("workload.params", "-");
+  return out;
+}
+
+MICRO_BENCH_DEF void micro_bench_startup_mark(const char *name)
+{
+  // The runner passes the write end of a pipe
+  static int fd = -2;
+  if (fd == -2)
+  {
+    const char *env = getenv("MICRO_BENCH_STARTUP_FD");
+    fd = env ? atoi(env) : -1;
+    // Programs started from here must not hold the pipe open, nor
+    // write their own marks to it
+    if (fd >= 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+      fd = -1;
+    if (env) unsetenv("MICRO_BENCH_STARTUP_FD");
+  }
+  if (fd < 0 || !name) return;
+  char line[96];
+  int len = snprintf(line, sizeof(line), "%.63s %llu\n", name,
+                     (unsigned long long)micro_bench_time_ns());
+  if (len > 0 && write(fd, line, (size_t)len) != len)
+    fd = -1;
+  return;
+}
+
+#if defined(MICRO_BENCH_STARTUP) && defined(__GNUC__)
+// Runs before the constructors of the program, after the loader
+__attribute__((constructor(101)))
+static void micro_bench_startup_constructor(void)
+{
+  micro_bench_startup_mark("constructor");
+  return;
+}
+#endif
+
+#define MICRO_BENCH_CAPTURE_MAGIC "MBCAPT01"
+#define MICRO_BENCH_CAPTURE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+MICRO_BENCH_DEF int micro_bench_capture_open(MicroBenchCapture *capture,
+                                             const char *path)
+{
+  if (!capture || !capture->serialize || !path) return -1;
+  size_t max_record = capture->max_record ? capture->max_record : 4096;
+  if (max_record > UINT32_MAX) return -1;
+  capture->max_record = max_record;
+  capture->calls = capture->recorded = capture->bytes = 0;
+  capture->scratch = (unsigned char *)malloc(max_record + 16);
+  if (!capture->scratch) return -1;
+  FILE *file = fopen(path, "wb");
+  if (!file || fwrite(MICRO_BENCH_CAPTURE_MAGIC, 8, 1, file) != 1)
+  {
+    if (file) fclose(file);
+    free(capture->scratch);
+    capture->scratch = NULL;
+    return -1;
+  }
+  capture->file = file;
+  capture->bytes = 8;
+
+  // Sample when the next random number is below the threshold, a
+  // rate of 1 or more records every call
+  double sample = capture->sample > 0.0 ? capture->sample : 1.0;
+  capture->threshold = sample >= 1.0 ? UINT64_MAX
+                       : (uint64_t)(sample * 18446744073709551616.0);
+  capture->state = capture->seed ? capture->seed : 1;
+  return 0;
+}
+
+MICRO_BENCH_DEF void micro_bench_capture(MicroBenchCapture *capture,
+                                         const void *input)
+{
+  if (!capture || !capture->file) return;
+  capture->calls++;
+  if (capture->threshold != UINT64_MAX
+      && micro_bench_random(&capture->state) >= capture->threshold)
+    return;
+
+  // Serialize after the header, then write both with padding
+  unsigned char *record = capture->scratch;
+  size_t size = capture->serialize(record + 8, capture->max_record, input);
+  if (size == 0 || size > capture->max_record) return;
+  uint32_t header[2] = { (uint32_t)size, 0 };
+  memcpy(record, header, 8);
+  size_t total = MICRO_BENCH_CAPTURE_ALIGN(8 + size);
+  memset(record + 8 + size, 0, total - 8 - size);
+  if (fwrite(record, total, 1, (FILE *)capture->file) != 1) return;
+  capture->recorded++;
+  capture->bytes += total;
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_capture_close(MicroBenchCapture *capture)
+{
+  if (!capture || !capture->file) return -1;
+  int ret = fclose((FILE *)capture->file) == 0 ? 0 : -1;
+  capture->file = NULL;
+  free(capture->scratch);
+  capture->scratch = NULL;
+  return ret;
+}
+
+MICRO_BENCH_DEF int micro_bench_replay_open(MicroBenchReplay *replay,
+                                            const char *path)
+{
+  if (!replay || !path) return -1;
+  replay->map = NULL;
+  replay->map_size = 0;
+  replay->records = replay->bytes = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 8)
+  {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  if (memcmp(map, MICRO_BENCH_CAPTURE_MAGIC, 8) != 0)
+  {
+    munmap(map, (size_t)size);
+    return -1;
+  }
+
+  // Count the complete records, touching every page so that the
+  // replay does not take page faults
+  unsigned char *bytes = (unsigned char *)map;
+  size_t end = (size_t)size, at = 8;
+  volatile unsigned char sink = 0;
+  for (size_t page = 0; page < end; page += 4096)
+    sink ^= bytes[page];
+  (void)sink;
+  while (at + 8 <= end)
+  {
+    uint32_t length;
+    memcpy(&length, bytes + at, 4);
+    size_t total = MICRO_BENCH_CAPTURE_ALIGN(8 + (size_t)length);
+    if (total > end - at) break;
+    replay->records++;
+    replay->bytes += length;
+    at += total;
+  }
+  replay->map = (unsigned char *)map;
+  replay->map_size = end;
+  micro_bench_metadata_set("replay.path", "%s", path);
+  micro_bench_metadata_set("replay.records", "%llu",
+                           (unsigned long long)replay->records);
+  return 0;
+}
+
+MICRO_BENCH_DEF uint64_t micro_bench_replay_run(MicroBenchReplay *replay,
+                                                MicroBench *mb,
+                                                MicroBenchReplayFn fn,
+                                                void *arg)
+{
+  if (!replay || !replay->map || !mb || !fn) return 0;
+  unsigned int batch = replay->batch ? replay->batch : 1;
+  unsigned int passes = replay->passes ? replay->passes : 1;
+  uint64_t done = 0;
+  for (unsigned int pass = 0; pass < passes; ++pass)
+  {
+    size_t at = 8;
+    uint64_t left = replay->records;
+    while (left > 0)
+    {
+      unsigned int n = left < batch ? (unsigned int)left : batch;
+      uint64_t bytes = 0;
+      micro_bench_start(mb);
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        uint32_t length;
+        memcpy(&length, replay->map + at, 4);
+        fn(replay->map + at + 8, length, arg);
+        at += MICRO_BENCH_CAPTURE_ALIGN(8 + (size_t)length);
+        bytes += length;
+      }
+      micro_bench_stop(mb);
+      micro_bench_add_bytes(mb, bytes);
+      left -= n;
+      done += n;
+    }
+  }
+  return done;
+}
+
+MICRO_BENCH_DEF void micro_bench_replay_close(MicroBenchReplay *replay)
+{
+  if (!replay || !replay->map) return;
+  munmap(replay->map, replay->map_size);
+  replay->map = NULL;
+  replay->map_size = 0;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_report(MicroBench *mb)
+{
+  micro_bench_report_with(mb, micro_bench_default_reporter_stdout);
+  return;
+}
+
+MICRO_BENCH_DEF void
+micro_bench_report_with(MicroBench *mb,
+                        MicroBenchReporter reporter)
+{
+  reporter(&mb->data);
+  return;
+}
+
+
+#ifdef MICRO_BENCH_LOCK_PROFILE
+
+#include <errno.h>
+
+#ifdef MICRO_BENCH_LOCK_WRAP
+  // The linker redirects these calls to the __wrap_ functions below,
+  // the profiler itself must reach the real implementation
+  #define MICRO_BENCH_REAL(fn) __real_##fn
+  extern int __real_pthread_mutex_lock(pthread_mutex_t *mutex);
+  extern int __real_pthread_mutex_unlock(pthread_mutex_t *mutex);
+  extern int __real_pthread_rwlock_rdlock(pthread_rwlock_t *rwlock);
+  extern int __real_pthread_rwlock_wrlock(pthread_rwlock_t *rwlock);
+  extern int __real_pthread_rwlock_unlock(pthread_rwlock_t *rwlock);
+  extern int __real_pthread_cond_wait(pthread_cond_t *cond,
+                                      pthread_mutex_t *mutex);
+#else
+  #define MICRO_BENCH_REAL(fn) fn
+#endif
+
+static MicroBenchLockSite micro_bench_lock_table[MICRO_BENCH_LOCK_SITES];
+static unsigned char micro_bench_lock_table_busy;
+
+// Locks held by the current thread, to measure hold times
+typedef struct {
+  const void *lock;
+  MicroBenchLockSite *site;
+  uint64_t acquired;
+} MicroBenchHeldLock;
+
+static __thread MicroBenchHeldLock
+micro_bench_held[MICRO_BENCH_LOCK_MAX_HELD];
+static __thread int micro_bench_held_count;
+
+static void micro_bench_spin_lock(unsigned char *flag)
+{
+  while (__atomic_test_and_set(flag, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(flag, __ATOMIC_RELAXED))
+      ;
+  return;
+}
+
+static void micro_bench_spin_unlock(unsigned char *flag)
+{
+  __atomic_clear(flag, __ATOMIC_RELEASE);
+  return;
+}
+
+static MicroBenchLockSite *
+micro_bench_lock_site(MicroBenchLockKind kind, const char *file,
+                      int line, const void *caller)
+{
+  uintptr_t key = file ? (uintptr_t)file * 31 + (uintptr_t)line
+                       : (uintptr_t)caller;
+  key = (key ^ (key >> 17)) * 0x9e3779b1u + (uintptr_t)kind;
+  size_t start = (size_t)(key % MICRO_BENCH_LOCK_SITES);
+
+  // Sites are never removed while running, so a published slot can
+  // be compared without holding the table lock
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    if (pass == 1)
+      micro_bench_spin_lock(&micro_bench_lock_table_busy);
+    for (size_t i = 0; i < MICRO_BENCH_LOCK_SITES; ++i)
+    {
+      MicroBenchLockSite *site =
+        &micro_bench_lock_table[(start + i) % MICRO_BENCH_LOCK_SITES];
+      if (!__atomic_load_n(&site->used, __ATOMIC_ACQUIRE))
+      {
+        if (pass == 0) break;
+        site->file = file;
+        site->line = line;
+        site->caller = caller;
+        site->kind = kind;
+        __atomic_store_n(&site->used, 1, __ATOMIC_RELEASE);
+        micro_bench_spin_unlock(&micro_bench_lock_table_busy);
+        return site;
+      }
+      if (site->kind == kind && site->file == file && site->line == line
+          && site->caller == caller)
+      {
+        if (pass == 1)
+          micro_bench_spin_unlock(&micro_bench_lock_table_busy);
+        return site;
+      }
+    }
+  }
+  // The table is full, drop the sample
+  micro_bench_spin_unlock(&micro_bench_lock_table_busy);
+  return NULL;
+}
+
+static void micro_bench_lock_acquired(MicroBenchLockSite *site,
+                                      const void *lock,
+                                      uint64_t begin, uint64_t end,
+                                      int contended)
+{
+  MICRO_BENCH_PROBE(lock_acquire, lock, end - begin);
+  if (!site) return;
+  micro_bench_spin_lock(&site->busy);
+  site->acquisitions++;
+  site->contended += contended ? 1 : 0;
+  if (site->kind != MICRO_BENCH_LOCK_COND)
+  {
+    micro_bench_stat_add(&site->wait, (end - begin) / 1e9);
+    micro_bench_histogram_add(&site->wait_histogram, end - begin);
+  }
+  micro_bench_spin_unlock(&site->busy);
+
+  if (micro_bench_held_count < MICRO_BENCH_LOCK_MAX_HELD)
+  {
+    MicroBenchHeldLock *held = &micro_bench_held[micro_bench_held_count++];
+    held->lock = lock;
+    held->site = site;
+    held->acquired = end;
+  }
+  return;
+}
+
+static void micro_bench_lock_released(const void *lock)
+{
+  uint64_t now = micro_bench_time_ns();
+  for (int i = micro_bench_held_count - 1; i >= 0; --i)
+  {
+    if (micro_bench_held[i].lock != lock) continue;
+    MicroBenchLockSite *site = micro_bench_held[i].site;
+    uint64_t hold = now - micro_bench_held[i].acquired;
+    MICRO_BENCH_PROBE(lock_release, lock, hold);
+    micro_bench_held[i] = micro_bench_held[--micro_bench_held_count];
+
+    micro_bench_spin_lock(&site->busy);
+    micro_bench_stat_add(&site->hold, hold / 1e9);
+    micro_bench_histogram_add(&site->hold_histogram, hold);
+    micro_bench_spin_unlock(&site->busy);
+    return;
+  }
+  return;
+}
+
+static int micro_bench_lock_profiled(MicroBenchLockKind kind, void *lock,
+                                     const char *file, int line,
+                                     const void *caller)
+{
+  MicroBenchLockSite *site = micro_bench_lock_site(kind, file, line, caller);
+  uint64_t begin = micro_bench_time_ns();
+  int err = 0, contended = 0;
+  switch (kind)
+  {
+  case MICRO_BENCH_LOCK_MUTEX:
+    contended = pthread_mutex_trylock((pthread_mutex_t *)lock) != 0;
+    if (contended)
+      err = MICRO_BENCH_REAL(pthread_mutex_lock)((pthread_mutex_t *)lock);
+    break;
+  case MICRO_BENCH_LOCK_RDLOCK:
+    contended = pthread_rwlock_tryrdlock((pthread_rwlock_t *)lock) != 0;
+    if (contended)
+      err = MICRO_BENCH_REAL(pthread_rwlock_rdlock)((pthread_rwlock_t *)lock);
+    break;
+  case MICRO_BENCH_LOCK_WRLOCK:
+    contended = pthread_rwlock_trywrlock((pthread_rwlock_t *)lock) != 0;
+    if (contended)
+      err = MICRO_BENCH_REAL(pthread_rwlock_wrlock)((pthread_rwlock_t *)lock);
+    break;
+  default:
+    return EINVAL;
+  }
+  if (err == 0)
+    micro_bench_lock_acquired(site, lock, begin, micro_bench_time_ns(),
+                              contended);
+  return err;
+}
+
+static int micro_bench_cond_profiled(pthread_cond_t *cond,
+                                     pthread_mutex_t *mutex,
+                                     const char *file, int line,
+                                     const void *caller)
+{
+  MicroBenchLockSite *site =
+    micro_bench_lock_site(MICRO_BENCH_LOCK_COND, file, line, caller);
+
+  // The mutex is released while waiting, end its hold time here
+  micro_bench_lock_released(mutex);
+  uint64_t begin = micro_bench_time_ns();
+  int err = MICRO_BENCH_REAL(pthread_cond_wait)(cond, mutex);
+  uint64_t end = micro_bench_time_ns();
+
+  if (site)
+  {
+    micro_bench_spin_lock(&site->busy);
+    site->acquisitions++;
+    micro_bench_stat_add(&site->wait, (end - begin) / 1e9);
+    micro_bench_histogram_add(&site->wait_histogram, end - begin);
+    micro_bench_spin_unlock(&site->busy);
+  }
+
+  // Hold time of the reacquired mutex is accounted to the wait site
+  if (micro_bench_held_count < MICRO_BENCH_LOCK_MAX_HELD && site)
+  {
+    MicroBenchHeldLock *held = &micro_bench_held[micro_bench_held_count++];
+    held->lock = mutex;
+    held->site = site;
+    held->acquired = end;
+  }
+  return err;
+}
+
+MICRO_BENCH_DEF int micro_bench_mutex_lock_at(pthread_mutex_t *mutex,
+                                              const char *file,
+                                              int line)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_MUTEX, mutex,
+                                   file, line, NULL);
+}
+
+MICRO_BENCH_DEF int micro_bench_mutex_unlock(pthread_mutex_t *mutex)
+{
+  micro_bench_lock_released(mutex);
+  return MICRO_BENCH_REAL(pthread_mutex_unlock)(mutex);
+}
+
+MICRO_BENCH_DEF int micro_bench_rwlock_rdlock_at(pthread_rwlock_t *rwlock,
+                                                 const char *file,
+                                                 int line)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_RDLOCK, rwlock,
+                                   file, line, NULL);
+}
+
+MICRO_BENCH_DEF int micro_bench_rwlock_wrlock_at(pthread_rwlock_t *rwlock,
+                                                 const char *file,
+                                                 int line)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_WRLOCK, rwlock,
+                                   file, line, NULL);
+}
+
+MICRO_BENCH_DEF int micro_bench_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+  micro_bench_lock_released(rwlock);
+  return MICRO_BENCH_REAL(pthread_rwlock_unlock)(rwlock);
+}
+
+MICRO_BENCH_DEF int micro_bench_cond_wait_at(pthread_cond_t *cond,
+                                             pthread_mutex_t *mutex,
+                                             const char *file,
+                                             int line)
+{
+  return micro_bench_cond_profiled(cond, mutex, file, line, NULL);
+}
+
+#ifdef MICRO_BENCH_LOCK_WRAP
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_MUTEX, mutex, NULL, 0,
+                                   __builtin_return_address(0));
+}
+
+int __wrap_pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+  return micro_bench_mutex_unlock(mutex);
+}
+
+int __wrap_pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_RDLOCK, rwlock, NULL, 0,
+                                   __builtin_return_address(0));
+}
+
+int __wrap_pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+  return micro_bench_lock_profiled(MICRO_BENCH_LOCK_WRLOCK, rwlock, NULL, 0,
+                                   __builtin_return_address(0));
+}
+
+int __wrap_pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+  return micro_bench_rwlock_unlock(rwlock);
+}
+
+int __wrap_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+  return micro_bench_cond_profiled(cond, mutex, NULL, 0,
+                                   __builtin_return_address(0));
+}
+
+#endif // MICRO_BENCH_LOCK_WRAP
+
+static int micro_bench_lock_site_compare(const void *a, const void *b)
+{
+  const MicroBenchLockSite *sa = (const MicroBenchLockSite *)a;
+  const MicroBenchLockSite *sb = (const MicroBenchLockSite *)b;
+  if (sa->wait.sum < sb->wait.sum) return 1;
+  if (sa->wait.sum > sb->wait.sum) return -1;
+  return 0;
+}
+
+MICRO_BENCH_DEF int micro_bench_lock_sites(MicroBenchLockSite *sites,
+                                           int max)
+{
+  if (!sites || max <= 0) return 0;
+  // Only used with the table lock held, it is shared by all callers
+  static MicroBenchLockSite all[MICRO_BENCH_LOCK_SITES];
+  int count = 0;
+
+  micro_bench_spin_lock(&micro_bench_lock_table_busy);
+  for (int i = 0; i < MICRO_BENCH_LOCK_SITES; ++i)
+  {
+    MicroBenchLockSite *site = &micro_bench_lock_table[i];
+    if (!__atomic_load_n(&site->used, __ATOMIC_ACQUIRE)) continue;
+    micro_bench_spin_lock(&site->busy);
+    all[count++] = *site;
+    micro_bench_spin_unlock(&site->busy);
+  }
+  qsort(all, (size_t)count, sizeof(all[0]), micro_bench_lock_site_compare);
+  if (count > max) count = max;
+  memcpy(sites, all, sizeof(all[0]) * (size_t)count);
+  micro_bench_spin_unlock(&micro_bench_lock_table_busy);
+  return count;
+}
+
+MICRO_BENCH_DEF void micro_bench_lock_report(void)
+{
+  static const char *kinds[] = { "mutex", "rdlock", "wrlock", "cond" };
+  MicroBenchLockSite *sites = (MicroBenchLockSite *)
+    malloc(sizeof(*sites) * MICRO_BENCH_LOCK_SITES);
+  if (!sites) return;
+  int count = micro_bench_lock_sites(sites, MICRO_BENCH_LOCK_SITES);
+
+  printf("\n");
+  printf("/--------------------------------------------------------------------------------------------------------\\\n");
+  printf("|                                         Lock contention report                                         |\n");
+  printf("|--------------------------------------------------------------------------------------------------------|\n");
+  printf("| site                     | kind   |   acquired | contended | wait (s)  | wait p99 (ns) | hold p99 (ns) |\n");
+  printf("|--------------------------------------------------------------------------------------------------------|\n");
+  for (int i = 0; i < count; ++i)
+  {
+    MicroBenchLockSite *site = &sites[i];
+    char name[64];
+    if (site->file)
+    {
+      const char *base = strrchr(site->file, '/');
+      snprintf(name, sizeof(name), "%s:%d", base ? base + 1 : site->file,
+               site->line);
+    }
+    else
+      snprintf(name, sizeof(name), "%p", (void *)(uintptr_t)site->caller);
+    printf("| %-24.24s | %-6s | %10llu | %9llu | %9.6f | %13llu | %13llu |\n",
+           name, kinds[site->kind],
+           (unsigned long long)site->acquisitions,
+           (unsigned long long)site->contended, site->wait.sum,
+           (unsigned long long)
+           micro_bench_histogram_percentile(&site->wait_histogram, 99.0),
+           (unsigned long long)
+           micro_bench_histogram_percentile(&site->hold_histogram, 99.0));
+  }
+  printf("\\--------------------------------------------------------------------------------------------------------/\n");
+  free(sites);
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_lock_clear(void)
+{
+  micro_bench_spin_lock(&micro_bench_lock_table_busy);
+  memset(micro_bench_lock_table, 0, sizeof(micro_bench_lock_table));
+  micro_bench_spin_unlock(&micro_bench_lock_table_busy);
+  return;
+}
+
+#endif // MICRO_BENCH_LOCK_PROFILE
+
+#ifdef MICRO_BENCH_SUITES
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+MICRO_BENCH_DEF int micro_bench_cpu_list(int *cpus, int max)
+{
+  if (!cpus || max <= 0) return 0;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max; ++cpu)
+      if (CPU_ISSET(cpu, &set))
+        cpus[count++] = cpu;
+    return count;
+  }
+#endif
+  cpus[0] = 0;
+  return 1;
+}
+
+MICRO_BENCH_DEF int micro_bench_pin_cpu(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return -1;
+  return 0;
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+typedef struct {
+  MicroBenchOsnoise *result;
+  uint64_t duration_ns;
+  uint64_t threshold_ns;
+} MicroBenchOsnoiseArg;
+
+static void *micro_bench_osnoise_thread(void *arg)
+{
+  MicroBenchOsnoiseArg *a = (MicroBenchOsnoiseArg *)arg;
+  MicroBenchOsnoise *r = a->result;
+  micro_bench_pin_cpu(r->cpu);
+
+  uint64_t start = micro_bench_time_ns();
+  uint64_t end = start + a->duration_ns;
+  uint64_t last = start;
+  while (last < end)
+  {
+    uint64_t now = micro_bench_time_ns();
+    uint64_t gap = now - last;
+    last = now;
+    if (gap <= a->threshold_ns) continue;
+
+    r->interruptions++;
+    r->noise_ns += gap;
+    micro_bench_histogram_add(&r->histogram, gap);
+    // Keep the worst gaps sorted in descending order
+    for (int i = 0; i < MICRO_BENCH_OSNOISE_WORST; ++i)
+    {
+      if (gap <= r->worst[i]) continue;
+      uint64_t tmp = r->worst[i];
+      r->worst[i] = gap;
+      gap = tmp;
+    }
+  }
+  r->runtime_ns = last - start;
+  return NULL;
+}
+
+MICRO_BENCH_DEF int micro_bench_osnoise_run(double duration,
+                                            uint64_t threshold_ns,
+                                            MicroBenchOsnoise *results,
+                                            int max)
+{
+  if (!results || max <= 0 || duration <= 0.0) return -1;
+
+  int *cpus = (int *)malloc(sizeof(int) * (size_t)max);
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)max);
+  MicroBenchOsnoiseArg *args =
+    (MicroBenchOsnoiseArg *)malloc(sizeof(*args) * (size_t)max);
+  if (!cpus || !threads || !args)
+  {
+    free(cpus); free(threads); free(args);
+    return -1;
+  }
+
+  int count = micro_bench_cpu_list(cpus, max);
+  int started = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    memset(&results[i], 0, sizeof(results[i]));
+    results[i].cpu = cpus[i];
+    args[i].result = &results[i];
+    args[i].duration_ns = (uint64_t)(duration * 1e9);
+    args[i].threshold_ns = threshold_ns;
+    if (pthread_create(&threads[i], NULL, micro_bench_osnoise_thread,
+                       &args[i]) != 0)
+      break;
+    started++;
+  }
+  for (int i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+
+  free(cpus); free(threads); free(args);
+  return (started == count) ? count : -1;
+}
+
+MICRO_BENCH_DEF void micro_bench_osnoise_report(MicroBenchOsnoise *results,
+                                                int count)
+{
+  if (!results) return;
+  printf("\n");
+  printf("/----------------------------------------------------------------------\\\n");
+  printf("|                            OS noise report                           |\n");
+  printf("|----------------------------------------------------------------------|\n");
+  printf("| cpu |  runtime (s)  |  noise (us)  | avail. %% | interr. | worst (us) |\n");
+  printf("|----------------------------------------------------------------------|\n");
+  for (int i = 0; i < count; ++i)
+  {
+    MicroBenchOsnoise *r = &results[i];
+    double avail = 100.0;
+    if (r->runtime_ns > 0)
+      avail = 100.0 * (1.0 - (double)r->noise_ns / (double)r->runtime_ns);
+    printf("| %3d | %13.6f | %12.3f | %8.4f | %7llu | %10.3f |\n",
+           r->cpu, r->runtime_ns / 1e9, r->noise_ns / 1e3, avail,
+           (unsigned long long)r->interruptions, r->worst[0] / 1e3);
+  }
+  printf("\\----------------------------------------------------------------------/\n");
+
+  for (int i = 0; i < count; ++i)
+  {
+    MicroBenchOsnoise *r = &results[i];
+    if (r->interruptions == 0) continue;
+    char title[64];
+    snprintf(title, sizeof(title), "CPU %d interruptions (ns)", r->cpu);
+    micro_bench_histogram_report(&r->histogram, title);
+    printf("worst gaps (ns):");
+    for (int w = 0; w < MICRO_BENCH_OSNOISE_WORST && r->worst[w] > 0; ++w)
+      printf(" %llu", (unsigned long long)r->worst[w]);
+    printf("\n");
+  }
+  return;
+}
+
+
+typedef struct {
+  MicroBenchThread *thread;
+  MicroBenchThreadFn fn;
+  void *arg;
+  volatile int *ready;
+  volatile int *go;
+} MicroBenchThreadStart;
+
+static void *micro_bench_thread_main(void *arg)
+{
+  MicroBenchThreadStart *start = (MicroBenchThreadStart *)arg;
+  if (start->thread->cpu >= 0)
+    micro_bench_pin_cpu(start->thread->cpu);
+
+  // Wait for all the threads to be ready before running the body
+  __atomic_add_fetch(start->ready, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(start->go, __ATOMIC_ACQUIRE))
+    ;
+  start->fn(start->thread, start->arg);
+  return NULL;
+}
+
+// Run the threads pinned round robin to [cpus], or not pinned if
+// [cpu_count] is zero
+static int micro_bench_run_threads_on(MicroBenchThread *threads,
+                                      int count, double duration,
+                                      const int *cpus, int cpu_count,
+                                      int node, MicroBenchThreadFn fn,
+                                      void *arg)
+{
+  if (!threads || count <= 0 || !fn) return -1;
+
+  pthread_t *handles = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)count);
+  MicroBenchThreadStart *starts =
+    (MicroBenchThreadStart *)malloc(sizeof(*starts) * (size_t)count);
+  if (!handles || !starts)
+  {
+    free(handles); free(starts);
+    return -1;
+  }
+
+  volatile int ready = 0, go = 0, stop = 0;
+  int started = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    MicroBenchThread *t = &threads[i];
+    memset(t, 0, sizeof(*t));
+    t->index = i;
+    t->count = count;
+    t->cpu = (cpu_count > 0) ? cpus[i % cpu_count] : -1;
+    t->node = node;
+    t->stop = &stop;
+    starts[i].thread = t;
+    starts[i].fn = fn;
+    starts[i].arg = arg;
+    starts[i].ready = &ready;
+    starts[i].go = &go;
+    if (pthread_create(&handles[i], NULL, micro_bench_thread_main,
+                       &starts[i]) != 0)
+      break;
+    started++;
+  }
+
+  // Release the threads even on error, so they can be joined
+  if (started != count)
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < started)
+    sched_yield();
+  __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+
+  if (duration > 0.0 && started == count)
+  {
+    struct timespec pause;
+    pause.tv_sec = (time_t)duration;
+    pause.tv_nsec = (long)((duration - (double)pause.tv_sec) * 1e9);
+    nanosleep(&pause, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < started; ++i)
+    pthread_join(handles[i], NULL);
+  for (int i = 0; i < count; ++i)
+    threads[i].stop = NULL;
+
+  free(handles); free(starts);
+  return (started == count) ? 0 : -1;
+}
+
+MICRO_BENCH_DEF int micro_bench_run_threads(MicroBenchThread *threads,
+                                            int count, double duration,
+                                            int pin, MicroBenchThreadFn fn,
+                                            void *arg)
+{
+  int cpus[CPU_SETSIZE];
+  int cpu_count = pin ? micro_bench_cpu_list(cpus, CPU_SETSIZE) : 0;
+  return micro_bench_run_threads_on(threads, count, duration, cpus,
+                                    cpu_count, -1, fn, arg);
+}
+
+MICRO_BENCH_DEF int micro_bench_run_threads_on_node(MicroBenchThread *threads,
+                                                    int count,
+                                                    double duration,
+                                                    int node,
+                                                    MicroBenchThreadFn fn,
+                                                    void *arg)
+{
+  int cpus[CPU_SETSIZE];
+  int cpu_count = micro_bench_numa_node_cpus(node, cpus, CPU_SETSIZE);
+  if (cpu_count <= 0) return -1;
+  micro_bench_metadata_set("numa.cpu_node", "%d", node);
+  return micro_bench_run_threads_on(threads, count, duration, cpus,
+                                    cpu_count, node, fn, arg);
+}
+
+MICRO_BENCH_DEF int micro_bench_thread_running(MicroBenchThread *thread)
+{
+  if (!thread || !thread->stop) return 0;
+  return !__atomic_load_n(thread->stop, __ATOMIC_RELAXED);
+}
+
+// Thread counts used by the suites when none are given: powers of
+// two below the number of allowed CPUs, then that number itself
+static int micro_bench_default_threads(int threads[32])
+{
+  int cpus[CPU_SETSIZE];
+  int cpu_count = micro_bench_cpu_list(cpus, CPU_SETSIZE);
+  int count = 0;
+  for (int n = 1; n < cpu_count && count < 31; n *= 2)
+    threads[count++] = n;
+  threads[count++] = cpu_count;
+  return count;
+}
+
+//
+// Built-in locks
+//
+
+typedef struct {
+  unsigned char flag;
+} MicroBenchTasLock;
+
+typedef struct {
+  unsigned int next;
+  unsigned int serving;
+} MicroBenchTicketLock;
+
+typedef struct MicroBenchMcsNode {
+  struct MicroBenchMcsNode *next;
+  int locked;
+} MicroBenchMcsNode;
+
+typedef struct {
+  MicroBenchMcsNode *tail;
+} MicroBenchMcsLock;
+
+static void *micro_bench_lock_alloc(size_t size)
+{
+  void *lock = NULL;
+  // One cache line per lock, so that runs do not share lines
+  if (posix_memalign(&lock, 64, size < 64 ? 64 : size) != 0)
+    return NULL;
+  memset(lock, 0, size);
+  return lock;
+}
+
+static void *micro_bench_mutex_create(void)
+{
+  pthread_mutex_t *m =
+    (pthread_mutex_t *)micro_bench_lock_alloc(sizeof(pthread_mutex_t));
+  if (m) pthread_mutex_init(m, NULL);
+  return m;
+}
+
+static void micro_bench_mutex_destroy(void *lock)
+{
+  pthread_mutex_destroy((pthread_mutex_t *)lock);
+  free(lock);
+  return;
+}
+
+static void micro_bench_mutex_acquire(void *lock, void *node)
+{
+  (void)node;
+  pthread_mutex_lock((pthread_mutex_t *)lock);
+  return;
+}
+
+static void micro_bench_mutex_release(void *lock, void *node)
+{
+  (void)node;
+  pthread_mutex_unlock((pthread_mutex_t *)lock);
+  return;
+}
+
+static void *micro_bench_spin_create(void)
+{
+  pthread_spinlock_t *s =
+    (pthread_spinlock_t *)micro_bench_lock_alloc(sizeof(pthread_spinlock_t));
+  if (s) pthread_spin_init(s, PTHREAD_PROCESS_PRIVATE);
+  return (void *)s;
+}
+
+static void micro_bench_spin_destroy(void *lock)
+{
+  pthread_spin_destroy((pthread_spinlock_t *)lock);
+  free(lock);
+  return;
+}
+
+static void micro_bench_spin_acquire(void *lock, void *node)
+{
+  (void)node;
+  pthread_spin_lock((pthread_spinlock_t *)lock);
+  return;
+}
+
+static void micro_bench_spin_release(void *lock, void *node)
+{
+  (void)node;
+  pthread_spin_unlock((pthread_spinlock_t *)lock);
+  return;
+}
+
+static void *micro_bench_rwlock_create(void)
+{
+  pthread_rwlock_t *l =
+    (pthread_rwlock_t *)micro_bench_lock_alloc(sizeof(pthread_rwlock_t));
+  if (l) pthread_rwlock_init(l, NULL);
+  return l;
+}
+
+static void micro_bench_rwlock_destroy(void *lock)
+{
+  pthread_rwlock_destroy((pthread_rwlock_t *)lock);
+  free(lock);
+  return;
+}
+
+static void micro_bench_rwlock_acquire(void *lock, void *node)
+{
+  (void)node;
+  pthread_rwlock_wrlock((pthread_rwlock_t *)lock);
+  return;
+}
+
+static void micro_bench_rwlock_release(void *lock, void *node)
+{
+  (void)node;
+  pthread_rwlock_unlock((pthread_rwlock_t *)lock);
+  return;
+}
+
+static void *micro_bench_tas_create(void)
+{
+  return micro_bench_lock_alloc(sizeof(MicroBenchTasLock));
+}
+
+static void micro_bench_tas_acquire(void *lock, void *node)
+{
+  (void)node;
+  MicroBenchTasLock *l = (MicroBenchTasLock *)lock;
+  while (__atomic_test_and_set(&l->flag, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&l->flag, __ATOMIC_RELAXED))
+      ;
+  return;
+}
+
+static void micro_bench_tas_release(void *lock, void *node)
+{
+  (void)node;
+  MicroBenchTasLock *l = (MicroBenchTasLock *)lock;
+  __atomic_clear(&l->flag, __ATOMIC_RELEASE);
+  return;
+}
+
+static void *micro_bench_ticket_create(void)
+{
+  return micro_bench_lock_alloc(sizeof(MicroBenchTicketLock));
+}
+
+static void micro_bench_ticket_acquire(void *lock, void *node)
+{
+  (void)node;
+  MicroBenchTicketLock *l = (MicroBenchTicketLock *)lock;
+  unsigned int ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) != ticket)
+    ;
+  return;
+}
+
+static void micro_bench_ticket_release(void *lock, void *node)
+{
+  (void)node;
+  MicroBenchTicketLock *l = (MicroBenchTicketLock *)lock;
+  __atomic_store_n(&l->serving, l->serving + 1, __ATOMIC_RELEASE);
+  return;
+}
+
+static void *micro_bench_mcs_create(void)
+{
+  return micro_bench_lock_alloc(sizeof(MicroBenchMcsLock));
+}
+
+static void micro_bench_mcs_acquire(void *lock, void *node)
+{
+  MicroBenchMcsLock *l = (MicroBenchMcsLock *)lock;
+  MicroBenchMcsNode *me = (MicroBenchMcsNode *)node;
+  me->next = NULL;
+  me->locked = 1;
+  MicroBenchMcsNode *prev = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+  if (!prev) return;
+  __atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE))
+    ;
+  return;
+}
+
+static void micro_bench_mcs_release(void *lock, void *node)
+{
+  MicroBenchMcsLock *l = (MicroBenchMcsLock *)lock;
+  MicroBenchMcsNode *me = (MicroBenchMcsNode *)node;
+  MicroBenchMcsNode *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+  if (!next)
+  {
+    MicroBenchMcsNode *expected = me;
+    if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+    // A successor is enqueueing itself, wait for the link
+    while (!(next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)))
+      ;
+  }
+  __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+  return;
+}
+
+static void micro_bench_free(void *lock)
+{
+  free(lock);
+  return;
+}
+
+static const MicroBenchLockImpl micro_bench_lock_builtin_impls[] = {
+  { "pthread_mutex", micro_bench_mutex_create, micro_bench_mutex_destroy,
+    micro_bench_mutex_acquire, micro_bench_mutex_release },
+  { "pthread_spin", micro_bench_spin_create, micro_bench_spin_destroy,
+    micro_bench_spin_acquire, micro_bench_spin_release },
+  { "ttas", micro_bench_tas_create, micro_bench_free,
+    micro_bench_tas_acquire, micro_bench_tas_release },
+  { "ticket", micro_bench_ticket_create, micro_bench_free,
+    micro_bench_ticket_acquire, micro_bench_ticket_release },
+  { "mcs", micro_bench_mcs_create, micro_bench_free,
+    micro_bench_mcs_acquire, micro_bench_mcs_release },
+  { "pthread_rwlock", micro_bench_rwlock_create, micro_bench_rwlock_destroy,
+    micro_bench_rwlock_acquire, micro_bench_rwlock_release },
+};
+
+MICRO_BENCH_DEF const MicroBenchLockImpl *micro_bench_lock_builtins(int *count)
+{
+  if (count)
+    *count = (int)(sizeof(micro_bench_lock_builtin_impls)
+                   / sizeof(micro_bench_lock_builtin_impls[0]));
+  return micro_bench_lock_builtin_impls;
+}
+
+//
+// Lock suite
+//
+
+typedef struct {
+  const MicroBenchLockImpl *impl;
+  void *lock;
+  unsigned int critical;
+  volatile uint64_t counter;        // protected by the lock
+} MicroBenchLocksRun;
+
+static void micro_bench_locks_thread(MicroBenchThread *thread, void *arg)
+{
+  MicroBenchLocksRun *run = (MicroBenchLocksRun *)arg;
+  union {
+    unsigned char bytes[MICRO_BENCH_LOCK_NODE_SIZE];
+    MicroBenchMcsNode mcs;
+  } node;
+
+  while (micro_bench_thread_running(thread))
+  {
+    uint64_t begin = micro_bench_time_ns();
+    run->impl->lock(run->lock, &node);
+    uint64_t acquired = micro_bench_time_ns();
+    for (volatile unsigned int i = 0; i < run->critical; ++i)
+      ;
+    run->counter++;
+    run->impl->unlock(run->lock, &node);
+    micro_bench_histogram_add(&thread->histogram, acquired - begin);
+    thread->ops++;
+  }
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_locks(MicroBenchLocksSuite *suite)
+{
+  MicroBenchLocksSuite defaults = {0};
+  if (!suite) suite = &defaults;
+
+  int impl_count = suite->impl_count;
+  const MicroBenchLockImpl *impls = suite->impls;
+  if (!impls)
+    impls = micro_bench_lock_builtins(&impl_count);
+
+  int default_threads[32];
+  const int *threads = suite->threads;
+  int thread_count = suite->thread_count;
+  if (!threads)
+  {
+    thread_count = micro_bench_default_threads(default_threads);
+    threads = default_threads;
+  }
+
+  static const unsigned int default_critical[] = { 0, 100 };
+  const unsigned int *critical = suite->critical;
+  int critical_count = suite->critical_count;
+  if (!critical)
+  {
+    critical = default_critical;
+    critical_count = 2;
+  }
+  double duration = suite->duration > 0.0 ? suite->duration : 0.5;
+
+  printf("\n");
+  printf("/----------------------------------------------------------------------------------------------------------------\\\n");
+  printf("|                                              Lock benchmark suite                                              |\n");
+  printf("|----------------------------------------------------------------------------------------------------------------|\n");
+  printf("| lock             | threads | critical |   Mops/s | p50 (ns) | p99 (ns) |   max (ns) | min/max share | fairness |\n");
+  printf("|----------------------------------------------------------------------------------------------------------------|\n");
+
+  for (int i = 0; i < impl_count; ++i)
+  for (int t = 0; t < thread_count; ++t)
+  for (int c = 0; c < critical_count; ++c)
+  {
+    int n = threads[t];
+    MicroBenchThread *th =
+      (MicroBenchThread *)malloc(sizeof(MicroBenchThread) * (size_t)n);
+    MicroBenchLocksRun run = {0};
+    run.impl = &impls[i];
+    run.lock = impls[i].create();
+    run.critical = critical[c];
+    if (!th || !run.lock
+        || micro_bench_run_threads(th, n, duration, suite->pin,
+                                   micro_bench_locks_thread, &run) != 0)
+    {
+      printf("| %-16.16s | %7d | %8u | %-72s|\n", impls[i].name, n,
+             critical[c], " failed");
+      free(th);
+      if (run.lock) impls[i].destroy(run.lock);
+      continue;
+    }
+
+    MicroBenchHistogram hist;
+    micro_bench_histogram_clear(&hist);
+    uint64_t total = 0, min_ops = th[0].ops, max_ops = th[0].ops;
+    double sum_sq = 0.0;
+    for (int k = 0; k < n; ++k)
+    {
+      micro_bench_histogram_merge(&hist, &th[k].histogram);
+      total += th[k].ops;
+      if (th[k].ops < min_ops) min_ops = th[k].ops;
+      if (th[k].ops > max_ops) max_ops = th[k].ops;
+      sum_sq += (double)th[k].ops * (double)th[k].ops;
+    }
+    // Jain's fairness index, 1 when all threads got the same share
+    double fairness = sum_sq > 0.0
+      ? (double)total * (double)total / ((double)n * sum_sq) : 0.0;
+    printf("| %-16.16s | %7d | %8u | %8.3f | %8llu | %8llu | %10llu | %5.1f%%/%5.1f%% | %8.4f |\n",
+           impls[i].name, n, critical[c], total / duration / 1e6,
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 99.0),
+           (unsigned long long)hist.max,
+           total ? 100.0 * (double)min_ops / (double)total : 0.0,
+           total ? 100.0 * (double)max_ops / (double)total : 0.0,
+           fairness);
+    free(th);
+    impls[i].destroy(run.lock);
+  }
+  printf("\\----------------------------------------------------------------------------------------------------------------/\n");
+  return;
+}
+
+
+//
+// Atomics suite
+//
+
+// Operations per timed batch, amortizing the cost of reading the clock
+#define MICRO_BENCH_ATOMIC_BATCH 1024
+
+// Stride between padded counters. Two cache lines, as the adjacent
+// line prefetcher pairs lines on many CPUs.
+#define MICRO_BENCH_PADDING 128
+
+typedef void (*MicroBenchAtomicFn)(uint64_t *p, unsigned int n);
+
+// The memory order must be a constant for the compiler to emit the
+// intended instructions, so each order gets its own functions
+#define MICRO_BENCH_ATOMIC_OPS(order, suffix)                            \
+  static void micro_bench_atomic_add_##suffix(uint64_t *p, unsigned int n) \
+  {                                                                      \
+    for (unsigned int i = 0; i < n; ++i)                                 \
+      (void)__atomic_fetch_add(p, 1, order);                             \
+  }                                                                      \
+  static void micro_bench_atomic_cas_##suffix(uint64_t *p, unsigned int n) \
+  {                                                                      \
+    for (unsigned int i = 0; i < n; ++i)                                 \
+    {                                                                    \
+      uint64_t expected = __atomic_load_n(p, __ATOMIC_RELAXED);          \
+      while (!__atomic_compare_exchange_n(p, &expected, expected + 1, 0, \
+                                          order, __ATOMIC_RELAXED))      \
+        ;                                                                \
+    }                                                                    \
+  }                                                                      \
+  static void micro_bench_atomic_xchg_##suffix(uint64_t *p, unsigned int n) \
+  {                                                                      \
+    for (unsigned int i = 0; i < n; ++i)                                 \
+      (void)__atomic_exchange_n(p, (uint64_t)i, order);                  \
+  }                                                                      \
+  static void micro_bench_atomic_fence_##suffix(uint64_t *p, unsigned int n) \
+  {                                                                      \
+    for (unsigned int i = 0; i < n; ++i)                                 \
+    {                                                                    \
+      __atomic_store_n(p, (uint64_t)i, __ATOMIC_RELAXED);                \
+      __atomic_thread_fence(order);                                      \
+    }                                                                    \
+  }
+
+MICRO_BENCH_ATOMIC_OPS(__ATOMIC_RELAXED, relaxed)
+MICRO_BENCH_ATOMIC_OPS(__ATOMIC_ACQ_REL, acq_rel)
+MICRO_BENCH_ATOMIC_OPS(__ATOMIC_SEQ_CST, seq_cst)
+
+static void micro_bench_plain_add(uint64_t *p, unsigned int n)
+{
+  volatile uint64_t *v = p;
+  for (unsigned int i = 0; i < n; ++i)
+    (*v)++;
+  return;
+}
+
+typedef struct {
+  const char *op;
+  const char *order;
+  MicroBenchAtomicFn fn;
+} MicroBenchAtomicOp;
+
+static const MicroBenchAtomicOp micro_bench_atomic_ops[] = {
+  { "fetch_add", "relaxed", micro_bench_atomic_add_relaxed },
+  { "fetch_add", "acq_rel", micro_bench_atomic_add_acq_rel },
+  { "fetch_add", "seq_cst", micro_bench_atomic_add_seq_cst },
+  { "cas",       "relaxed", micro_bench_atomic_cas_relaxed },
+  { "cas",       "acq_rel", micro_bench_atomic_cas_acq_rel },
+  { "cas",       "seq_cst", micro_bench_atomic_cas_seq_cst },
+  { "exchange",  "relaxed", micro_bench_atomic_xchg_relaxed },
+  { "exchange",  "acq_rel", micro_bench_atomic_xchg_acq_rel },
+  { "exchange",  "seq_cst", micro_bench_atomic_xchg_seq_cst },
+  // A relaxed fence emits nothing, this is the cost of the store alone
+  { "fence",     "baseline", micro_bench_atomic_fence_relaxed },
+  { "fence",     "acq_rel", micro_bench_atomic_fence_acq_rel },
+  { "fence",     "seq_cst", micro_bench_atomic_fence_seq_cst },
+};
+
+typedef struct {
+  MicroBenchAtomicFn fn;
+  unsigned char *base;     // counters, one per thread at [stride]
+  size_t stride;           // 0 to share a single counter
+} MicroBenchAtomicsRun;
+
+static void micro_bench_atomics_thread(MicroBenchThread *thread, void *arg)
+{
+  MicroBenchAtomicsRun *run = (MicroBenchAtomicsRun *)arg;
+  uint64_t *p = (uint64_t *)(run->base + run->stride * (size_t)thread->index);
+  while (micro_bench_thread_running(thread))
+  {
+    uint64_t begin = micro_bench_time_ns();
+    run->fn(p, MICRO_BENCH_ATOMIC_BATCH);
+    micro_bench_histogram_add(&thread->histogram,
+                              micro_bench_time_ns() - begin);
+    thread->ops += MICRO_BENCH_ATOMIC_BATCH;
+  }
+  return;
+}
+
+// Run [run] on [n] threads. Writes the median time per operation in
+// nanoseconds to [ns_per_op] and returns the total operations per
+// second, or -1 on error.
+static double micro_bench_atomics_measure(MicroBenchAtomicsRun *run, int n,
+                                          double duration, int pin,
+                                          double *ns_per_op)
+{
+  MicroBenchThread *th =
+    (MicroBenchThread *)malloc(sizeof(MicroBenchThread) * (size_t)n);
+  if (!th || micro_bench_run_threads(th, n, duration, pin,
+                                     micro_bench_atomics_thread, run) != 0)
+  {
+    free(th);
+    return -1.0;
+  }
+  MicroBenchHistogram hist;
+  micro_bench_histogram_clear(&hist);
+  uint64_t total = 0;
+  for (int k = 0; k < n; ++k)
+  {
+    micro_bench_histogram_merge(&hist, &th[k].histogram);
+    total += th[k].ops;
+  }
+  free(th);
+  *ns_per_op = (double)micro_bench_histogram_percentile(&hist, 50.0)
+    / MICRO_BENCH_ATOMIC_BATCH;
+  return (double)total / duration;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_atomics(MicroBenchAtomicsSuite *suite)
+{
+  MicroBenchAtomicsSuite defaults = {0};
+  if (!suite) suite = &defaults;
+
+  int default_threads[32];
+  const int *threads = suite->threads;
+  int thread_count = suite->thread_count;
+  if (!threads)
+  {
+    thread_count = micro_bench_default_threads(default_threads);
+    threads = default_threads;
+  }
+  int max_threads = 1;
+  for (int t = 0; t < thread_count; ++t)
+    if (threads[t] > max_threads) max_threads = threads[t];
+  double duration = suite->duration > 0.0 ? suite->duration : 0.2;
+
+  unsigned char *counters = NULL;
+  if (posix_memalign((void **)&counters, MICRO_BENCH_PADDING,
+                     MICRO_BENCH_PADDING * (size_t)max_threads) != 0)
+    return;
+  memset(counters, 0, MICRO_BENCH_PADDING * (size_t)max_threads);
+
+  printf("\n");
+  printf("/--------------------------------------------------------------\\\n");
+  printf("|                   Atomic operations suite                    |\n");
+  printf("|--------------------------------------------------------------|\n");
+  printf("| operation  | order    | threads | ns/op (p50) |     Mops/s   |\n");
+  printf("|--------------------------------------------------------------|\n");
+  int op_count = (int)(sizeof(micro_bench_atomic_ops)
+                       / sizeof(micro_bench_atomic_ops[0]));
+  for (int i = 0; i < op_count; ++i)
+  for (int t = 0; t < thread_count; ++t)
+  {
+    MicroBenchAtomicsRun run = { micro_bench_atomic_ops[i].fn, counters, 0 };
+    double ns_per_op = 0.0;
+    double ops = micro_bench_atomics_measure(&run, threads[t], duration,
+                                             suite->pin, &ns_per_op);
+    if (ops < 0.0)
+    {
+      printf("| %-10s | %-8s | %7d | %-27s|\n",
+             micro_bench_atomic_ops[i].op, micro_bench_atomic_ops[i].order,
+             threads[t], " failed");
+      continue;
+    }
+    printf("| %-10s | %-8s | %7d | %11.2f | %12.3f |\n",
+           micro_bench_atomic_ops[i].op, micro_bench_atomic_ops[i].order,
+           threads[t], ns_per_op, ops / 1e6);
+  }
+  printf("|--------------------------------------------------------------|\n");
+  printf("|                        False sharing                         |\n");
+  printf("|--------------------------------------------------------------|\n");
+  printf("| counters | threads | packed ns/op | padded ns/op | penalty   |\n");
+  printf("|--------------------------------------------------------------|\n");
+  for (int t = 0; t < thread_count; ++t)
+  {
+    static const struct {
+      const char *name;
+      MicroBenchAtomicFn fn;
+    } kinds[] = {
+      { "plain", micro_bench_plain_add },
+      { "atomic", micro_bench_atomic_add_relaxed },
+    };
+    for (int k = 0; k < 2; ++k)
+    {
+      MicroBenchAtomicsRun packed = { kinds[k].fn, counters, sizeof(uint64_t) };
+      MicroBenchAtomicsRun padded = { kinds[k].fn, counters, MICRO_BENCH_PADDING };
+      double ns_packed = 0.0, ns_padded = 0.0;
+      if (micro_bench_atomics_measure(&packed, threads[t], duration,
+                                      suite->pin, &ns_packed) < 0.0
+          || micro_bench_atomics_measure(&padded, threads[t], duration,
+                                         suite->pin, &ns_padded) < 0.0)
+      {
+        printf("| %-8s | %7d | %-40s|\n", kinds[k].name, threads[t],
+               " failed");
+        continue;
+      }
+      printf("| %-8s | %7d | %12.2f | %12.2f | %8.2fx |\n",
+             kinds[k].name, threads[t], ns_packed, ns_padded,
+             ns_padded > 0.0 ? ns_packed / ns_padded : 0.0);
+    }
+  }
+  printf("\\--------------------------------------------------------------/\n");
+  free(counters);
+  return;
+}
+
+
+//
+// Memory bandwidth suite
+//
+
+enum {
+  MICRO_BENCH_STREAM_COPY = 0,
+  MICRO_BENCH_STREAM_SCALE,
+  MICRO_BENCH_STREAM_ADD,
+  MICRO_BENCH_STREAM_TRIAD,
+  MICRO_BENCH_STREAM_READ,
+  MICRO_BENCH_STREAM_WRITE_NT,
+  MICRO_BENCH_STREAM_KERNELS,
+};
+
+static const struct {
+  const char *name;
+  unsigned int bytes;      // bytes moved per element
+} micro_bench_stream_kernels[MICRO_BENCH_STREAM_KERNELS] = {
+  { "copy", 16 },
+  { "scale", 16 },
+  { "add", 24 },
+  { "triad", 24 },
+  { "read", 8 },
+  { "write (nt)", 8 },
+};
+
+typedef struct {
+  int kernel;
+  double *a, *b, *c;
+  size_t n;                // elements per array
+} MicroBenchStreamRun;
+
+static volatile double micro_bench_stream_sink;
+
+static void micro_bench_stream_kernel(int kernel, double *a, double *b,
+                                      double *c, size_t n)
+{
+  const double scalar = 3.0;
+  size_t i = 0;
+  switch (kernel)
+  {
+  case MICRO_BENCH_STREAM_COPY:
+    for (i = 0; i < n; ++i) c[i] = a[i];
+    break;
+  case MICRO_BENCH_STREAM_SCALE:
+    for (i = 0; i < n; ++i) b[i] = scalar * c[i];
+    break;
+  case MICRO_BENCH_STREAM_ADD:
+    for (i = 0; i < n; ++i) c[i] = a[i] + b[i];
+    break;
+  case MICRO_BENCH_STREAM_TRIAD:
+    for (i = 0; i < n; ++i) a[i] = b[i] + scalar * c[i];
+    break;
+  case MICRO_BENCH_STREAM_READ:
+  {
+    // Independent sums, so the loop is not bound by the add latency
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+      s0 += a[i];
+      s1 += a[i + 1];
+      s2 += a[i + 2];
+      s3 += a[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i];
+    micro_bench_stream_sink = s0 + s1 + s2 + s3;
+    break;
+  }
+  case MICRO_BENCH_STREAM_WRITE_NT:
+#ifdef __SSE2__
+    {
+      // Non-temporal stores bypass the cache, no read for ownership
+      __m128d v = _mm_set1_pd(scalar);
+      for (i = 0; i + 2 <= n; i += 2)
+        _mm_stream_pd(&a[i], v);
+      _mm_sfence();
+    }
+#endif
+    for (; i < n; ++i) a[i] = scalar;
+    break;
+  default:
+    break;
+  }
+  return;
+}
+
+// Elements of the chunk of [thread], aligned on cache lines
+static size_t micro_bench_stream_chunk(MicroBenchThread *thread, size_t n,
+                                       size_t *offset)
+{
+  size_t chunk = (n / (size_t)thread->count) & ~(size_t)7;
+  *offset = chunk * (size_t)thread->index;
+  if (thread->index == thread->count - 1)
+    return n - *offset;
+  return chunk;
+}
+
+static void micro_bench_stream_init_thread(MicroBenchThread *thread,
+                                           void *arg)
+{
+  MicroBenchStreamRun *run = (MicroBenchStreamRun *)arg;
+  size_t offset;
+  size_t n = micro_bench_stream_chunk(thread, run->n, &offset);
+  for (size_t i = offset; i < offset + n; ++i)
+  {
+    run->a[i] = 1.0;
+    run->b[i] = 2.0;
+    run->c[i] = 0.0;
+  }
+  return;
+}
+
+static void micro_bench_stream_thread(MicroBenchThread *thread, void *arg)
+{
+  MicroBenchStreamRun *run = (MicroBenchStreamRun *)arg;
+  size_t offset;
+  size_t n = micro_bench_stream_chunk(thread, run->n, &offset);
+  while (micro_bench_thread_running(thread))
+  {
+    micro_bench_start(&thread->mb);
+    micro_bench_stream_kernel(run->kernel, run->a + offset,
+                              run->b + offset, run->c + offset, n);
+    micro_bench_stop(&thread->mb);
+    micro_bench_add_bytes(&thread->mb,
+      (uint64_t)n * micro_bench_stream_kernels[run->kernel].bytes);
+  }
+  return;
+}
+
+// Allocate the arrays of [run] and touch them, from the workers
+// if [worker_touch] is set or from the calling thread otherwise
+static int micro_bench_stream_alloc(MicroBenchStreamRun *run, int threads,
+                                    int pin, int worker_touch)
+{
+  size_t bytes = run->n * sizeof(double);
+  void *a = NULL, *b = NULL, *c = NULL;
+  if (posix_memalign(&a, 4096, bytes) != 0) a = NULL;
+  if (posix_memalign(&b, 4096, bytes) != 0) b = NULL;
+  if (posix_memalign(&c, 4096, bytes) != 0) c = NULL;
+  run->a = (double *)a;
+  run->b = (double *)b;
+  run->c = (double *)c;
+  if (!a || !b || !c) return -1;
+
+  if (!worker_touch)
+  {
+    MicroBenchThread self = {0};
+    self.count = 1;
+    micro_bench_stream_init_thread(&self, run);
+    return 0;
+  }
+  MicroBenchThread *th =
+    (MicroBenchThread *)malloc(sizeof(MicroBenchThread) * (size_t)threads);
+  int err = th ? micro_bench_run_threads(th, threads, 0.0, pin,
+                                         micro_bench_stream_init_thread,
+                                         run) : -1;
+  free(th);
+  return err;
+}
+
+static void micro_bench_stream_free(MicroBenchStreamRun *run)
+{
+  free(run->a);
+  free(run->b);
+  free(run->c);
+  run->a = run->b = run->c = NULL;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_stream(MicroBenchStreamSuite *suite)
+{
+  MicroBenchStreamSuite defaults = {0};
+  if (!suite) suite = &defaults;
+
+  int default_threads[32];
+  const int *threads = suite->threads;
+  int thread_count = suite->thread_count;
+  if (!threads)
+  {
+    thread_count = micro_bench_default_threads(default_threads);
+    threads = default_threads;
+  }
+  size_t size = suite->size > 0 ? suite->size : ((size_t)64 << 20);
+  double duration = suite->duration > 0.0 ? suite->duration : 0.5;
+  static const char *placements[] = { "workers", "main" };
+
+  printf("\n");
+  printf("/---------------------------------------------------------------\\\n");
+  printf("|                    Memory bandwidth suite                     |\n");
+  printf("|---------------------------------------------------------------|\n");
+  printf("|   array size   |  %9.1f MiB                               |\n",
+         size / 1048576.0);
+  printf("|---------------------------------------------------------------|\n");
+  printf("| kernel     | touched | threads |     GB/s    | GB/s / thread  |\n");
+  printf("|---------------------------------------------------------------|\n");
+
+  for (int p = 0; p < 2; ++p)
+  for (int t = 0; t < thread_count; ++t)
+  {
+    MicroBenchStreamRun run = {0};
+    run.n = size / sizeof(double);
+    int n = threads[t];
+    // Each worker runs on the CPU that touched its chunk
+    int pin = suite->pin || p == 0;
+    MicroBenchThread *th =
+      (MicroBenchThread *)malloc(sizeof(MicroBenchThread) * (size_t)n);
+    if (!th || micro_bench_stream_alloc(&run, n, pin, p == 0) != 0)
+    {
+      printf("| %-10s | %-7s | %7d | %-29s|\n", "all", placements[p], n,
+             " allocation failed");
+      free(th);
+      micro_bench_stream_free(&run);
+      continue;
+    }
+
+    for (int k = 0; k < MICRO_BENCH_STREAM_KERNELS; ++k)
+    {
+      run.kernel = k;
+      if (micro_bench_run_threads(th, n, duration, pin,
+                                  micro_bench_stream_thread, &run) != 0)
+        continue;
+      // Threads run concurrently, divide by the duration of the run
+      MicroBenchData data = {0};
+      double wall = 0.0;
+      for (int i = 0; i < n; ++i)
+      {
+        micro_bench_data_merge(&data, &th[i].mb.data);
+        if (th[i].mb.data.sum_real > wall)
+          wall = th[i].mb.data.sum_real;
+      }
+      double gbs = wall > 0.0 ? (double)data.bytes / wall / 1e9 : 0.0;
+      printf("| %-10s | %-7s | %7d | %11.3f | %14.3f |\n",
+             micro_bench_stream_kernels[k].name, placements[p], n, gbs,
+             gbs / n);
+    }
+    free(th);
+    micro_bench_stream_free(&run);
+  }
+  printf("\\---------------------------------------------------------------/\n");
+  return;
+}
+
+
+//
+// NUMA
+//
+
+// Parse a list such as "0-3,8,10-11" from the file at [path]
+static int micro_bench_read_list(const char *path, int *out, int max)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+  char buf[4096];
+  size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[len] = '\0';
+
+  int count = 0;
+  char *p = buf;
+  while (*p && *p != '\n' && count < max)
+  {
+    char *end;
+    long lo = strtol(p, &end, 10);
+    if (end == p) break;
+    long hi = lo;
+    if (*end == '-')
+    {
+      p = end + 1;
+      hi = strtol(p, &end, 10);
+    }
+    for (long v = lo; v <= hi && count < max; ++v)
+      out[count++] = (int)v;
+    p = (*end == ',') ? end + 1 : end;
+  }
+  return count;
+}
+
+MICRO_BENCH_DEF int micro_bench_numa_nodes(int *nodes, int max)
+{
+  if (!nodes || max <= 0) return 0;
+  int count = micro_bench_read_list("/sys/devices/system/node/online",
+                                    nodes, max);
+  if (count <= 0)
+  {
+    nodes[0] = 0;
+    count = 1;
+  }
+  return count;
+}
+
+MICRO_BENCH_DEF int micro_bench_numa_node_cpus(int node, int *cpus, int max)
+{
+  if (!cpus || max <= 0) return 0;
+  int allowed[CPU_SETSIZE];
+  int allowed_count = micro_bench_cpu_list(allowed, CPU_SETSIZE);
+
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  int node_cpus[CPU_SETSIZE];
+  int node_count = micro_bench_read_list(path, node_cpus, CPU_SETSIZE);
+  if (node_count < 0)
+  {
+    // Without NUMA information everything is on node 0
+    if (node != 0) return 0;
+    int count = allowed_count < max ? allowed_count : max;
+    memcpy(cpus, allowed, sizeof(int) * (size_t)count);
+    return count;
+  }
+
+  int count = 0;
+  for (int i = 0; i < node_count && count < max; ++i)
+    for (int j = 0; j < allowed_count; ++j)
+      if (node_cpus[i] == allowed[j])
+      {
+        cpus[count++] = node_cpus[i];
+        break;
+      }
+  return count;
+}
+
+MICRO_BENCH_DEF int micro_bench_numa_bind_thread(int node)
+{
+#ifdef __linux__
+  int cpus[CPU_SETSIZE];
+  int count = micro_bench_numa_node_cpus(node, cpus, CPU_SETSIZE);
+  if (count <= 0) return -1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < count; ++i)
+    CPU_SET(cpus[i], &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return -1;
+  return 0;
+#else
+  (void)node;
+  return -1;
+#endif
+}
+
+MICRO_BENCH_DEF void *micro_bench_numa_alloc(size_t size, int node)
+{
+  if (size == 0 || node < 0 || node >= MICRO_BENCH_MAX_NODES) return NULL;
+  void *ptr = micro_bench_map(size, 0);
+  if (!ptr) return NULL;
+  // Fails on kernels without NUMA, the kernel places pages as usual
+  micro_bench_mbind(ptr, size, node);
+  // Fault the pages in now, not in the timed region
+  for (size_t i = 0; i < size; i += 4096)
+    ((volatile unsigned char *)ptr)[i] = 0;
+  return ptr;
+}
+
+MICRO_BENCH_DEF void micro_bench_numa_free(void *ptr, size_t size)
+{
+  if (ptr) munmap(ptr, size);
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_numa_node_of(void *ptr)
+{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, NULL, 0UL, ptr,
+              (unsigned long)(MICRO_BENCH_MPOL_F_NODE
+                              | MICRO_BENCH_MPOL_F_ADDR)) == 0)
+    return node;
+#else
+  (void)ptr;
+#endif
+  return -1;
+}
+
+//
+// NUMA matrix suite
+//
+
+typedef struct {
+  void *buffer;
+  size_t size;
+  int latency;             // pointer chase, or read bandwidth
+  double result;           // ns per load, or GB/s
+} MicroBenchNumaRun;
+
+// Link the cache lines of [buffer] in a single random cycle, so that
+// the prefetchers cannot guess the next address
+static int micro_bench_chase_init(void *buffer, size_t size)
+{
+  size_t lines = size / 64;
+  size_t *order = (size_t *)malloc(sizeof(size_t) * lines);
+  if (!order || lines < 2)
+  {
+    free(order);
+    return -1;
+  }
+  for (size_t i = 0; i < lines; ++i)
+    order[i] = i;
+  // Sattolo's algorithm, with a fixed xorshift seed
+  uint64_t x = 0x9e3779b97f4a7c15ull;
+  for (size_t i = lines - 1; i > 0; --i)
+  {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    size_t j = (size_t)(x % i);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  unsigned char *base = (unsigned char *)buffer;
+  for (size_t i = 0; i < lines; ++i)
+    *(void **)(base + order[i] * 64) = base + order[(i + 1) % lines] * 64;
+  free(order);
+  return 0;
+}
+
+static void micro_bench_numa_thread(MicroBenchThread *thread, void *arg)
+{
+  MicroBenchNumaRun *run = (MicroBenchNumaRun *)arg;
+  uint64_t loads = 0, elapsed = 0;
+  void **p = (void **)run->buffer;
+  while (micro_bench_thread_running(thread))
+  {
+    uint64_t begin = micro_bench_time_ns();
+    if (run->latency)
+    {
+      for (int i = 0; i < 1024; ++i)
+        p = (void **)*p;
+      loads += 1024;
+    }
+    else
+    {
+      micro_bench_stream_kernel(MICRO_BENCH_STREAM_READ,
+                                (double *)run->buffer, NULL, NULL,
+                                run->size / sizeof(double));
+      loads += run->size;
+    }
+    elapsed += micro_bench_time_ns() - begin;
+  }
+  // Keep the chase alive
+  micro_bench_stream_sink = (double)(uintptr_t)p;
+  if (elapsed == 0) return;
+  run->result = run->latency ? (double)elapsed / (double)loads
+                             : (double)loads / (double)elapsed;
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_numa(MicroBenchNumaSuite *suite)
+{
+  MicroBenchNumaSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  size_t size = suite->size > 0 ? suite->size : ((size_t)64 << 20);
+  double duration = suite->duration > 0.0 ? suite->duration : 0.2;
+
+  int nodes[64];
+  int count = micro_bench_numa_nodes(nodes, 64);
+  micro_bench_metadata_set("numa.nodes", "%d", count);
+  double *latency = (double *)calloc((size_t)(count * count), sizeof(double));
+  double *bandwidth =
+    (double *)calloc((size_t)(count * count), sizeof(double));
+  if (!latency || !bandwidth)
+  {
+    free(latency); free(bandwidth);
+    return;
+  }
+
+  for (int m = 0; m < count; ++m)
+  {
+    void *buffer = micro_bench_numa_alloc(size, nodes[m]);
+    if (!buffer) continue;
+    micro_bench_metadata_set("numa.mem_node", "%d", nodes[m]);
+    if (micro_bench_numa_node_of(buffer) != -1
+        && micro_bench_numa_node_of(buffer) != nodes[m])
+      micro_bench_metadata_set("numa.warning",
+                               "pages not on the requested node %d",
+                               nodes[m]);
+    // The read kernel does not write, the chain is built only once
+    int chase = micro_bench_chase_init(buffer, size) == 0;
+    for (int c = 0; c < count; ++c)
+    for (int latency_run = 0; latency_run < 2; ++latency_run)
+    {
+      MicroBenchNumaRun run = { buffer, size, latency_run, 0.0 };
+      if (latency_run && !chase)
+        continue;
+      MicroBenchThread thread;
+      if (micro_bench_run_threads_on_node(&thread, 1, duration, nodes[c],
+                                          micro_bench_numa_thread,
+                                          &run) != 0)
+        continue;
+      if (latency_run)
+        latency[c * count + m] = run.result;
+      else
+        bandwidth[c * count + m] = run.result;
+    }
+    micro_bench_numa_free(buffer, size);
+  }
+
+  printf("\n");
+  printf("NUMA matrix, CPU node in rows, memory node in columns\n");
+  if (count == 1)
+    printf("Single NUMA node, only local access can be measured\n");
+  for (int table = 0; table < 2; ++table)
+  {
+    printf("\n%s\n", table == 0 ? "Load latency (ns)" : "Read bandwidth (GB/s)");
+    printf("  cpu\\mem ");
+    for (int m = 0; m < count; ++m)
+      printf(" %9d", nodes[m]);
+    printf("\n");
+    for (int c = 0; c < count; ++c)
+    {
+      printf("  %7d ", nodes[c]);
+      for (int m = 0; m < count; ++m)
+        printf(" %9.2f", table == 0 ? latency[c * count + m]
+                                    : bandwidth[c * count + m]);
+      printf("\n");
+    }
+  }
+  printf("\n");
+  micro_bench_metadata_report();
+  free(latency);
+  free(bandwidth);
+  return;
+}
+
+
+//
+// Data movement suite
+//
+
+static MicroBenchMemImpl micro_bench_mem_impls[MICRO_BENCH_MEM_IMPLS];
+static int micro_bench_mem_impl_count;
+
+MICRO_BENCH_DEF int micro_bench_mem_register(const MicroBenchMemImpl *impl)
+{
+  if (!impl || micro_bench_mem_impl_count == MICRO_BENCH_MEM_IMPLS)
+    return -1;
+  micro_bench_mem_impls[micro_bench_mem_impl_count++] = *impl;
+  return 0;
+}
+
+static volatile size_t micro_bench_mem_sink;
+
+static void micro_bench_mem_call(const MicroBenchMemImpl *impl,
+                                 unsigned char *dst, unsigned char *src,
+                                 size_t n)
+{
+  switch (impl->kind)
+  {
+  case MICRO_BENCH_MEMCPY:
+  case MICRO_BENCH_MEMMOVE:
+    impl->copy(dst, src, n);
+    break;
+  case MICRO_BENCH_MEMSET:
+    impl->set(dst, 0x5a, n);
+    break;
+  case MICRO_BENCH_MEMCMP:
+    micro_bench_mem_sink = (size_t)impl->compare(dst, src, n);
+    break;
+  case MICRO_BENCH_STRLEN:
+    micro_bench_mem_sink = impl->length((const char *)src);
+    break;
+  default:
+    break;
+  }
+  return;
+}
+
+// Time [impl] on regions of [n] bytes. The cold run moves to the next
+// region of the pools on every call. Returns seconds per call.
+static double micro_bench_mem_measure(const MicroBenchMemImpl *impl,
+                                      unsigned char *dst, unsigned char *src,
+                                      size_t pool, size_t n, int cold,
+                                      double duration, MicroBench *mb)
+{
+  // Regions on separate cache lines, pool wide when they do not fit
+  size_t stride = (n + 63) & ~(size_t)63;
+  size_t regions = cold ? pool / stride : 1;
+  if (regions == 0) regions = 1;
+
+  // Calls per sample, enough to make the clock overhead negligible
+  unsigned long batch = 1;
+  size_t region = 0;
+  for (;;)
+  {
+    uint64_t begin = micro_bench_time_ns();
+    for (unsigned long i = 0; i < batch; ++i)
+    {
+      micro_bench_mem_call(impl, dst + region * stride,
+                           src + region * stride, n);
+      if (++region == regions) region = 0;
+    }
+    if (micro_bench_time_ns() - begin > 20000 || batch >= (1ul << 24))
+      break;
+    batch *= 2;
+  }
+
+  micro_bench_init(mb);
+  uint64_t end = micro_bench_time_ns() + (uint64_t)(duration * 1e9);
+  do
+  {
+    micro_bench_start(mb);
+    for (unsigned long i = 0; i < batch; ++i)
+    {
+      micro_bench_mem_call(impl, dst + region * stride,
+                           src + region * stride, n);
+      if (++region == regions) region = 0;
+    }
+    micro_bench_stop(mb);
+    micro_bench_add_bytes(mb, (uint64_t)n * batch);
+  } while (micro_bench_time_ns() < end);
+  return mb->data.min_real / (double)batch;
+}
+
+// Size of the largest CPU cache in bytes from sysfs, 0 if unknown
+static size_t micro_bench_llc_size(void)
+{
+  size_t largest = 0;
+  for (int index = 0; index < 16; ++index)
+  {
+    char path[128];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+    FILE *f = fopen(path, "r");
+    if (!f) continue;
+    unsigned long value = 0;
+    char unit = 0;
+    if (fscanf(f, "%lu%c", &value, &unit) >= 1)
+    {
+      size_t size = value;
+      if (unit == 'K') size <<= 10;
+      else if (unit == 'M') size <<= 20;
+      else if (unit == 'G') size <<= 30;
+      if (size > largest) largest = size;
+    }
+    fclose(f);
+  }
+  return largest;
+}
+
+// Terminate every region of the pool for strlen
+static void micro_bench_mem_strings(unsigned char *src, size_t pool, size_t n)
+{
+  size_t stride = (n + 63) & ~(size_t)63;
+  memset(src, 'a', pool);
+  for (size_t at = 0; at + stride <= pool; at += stride)
+    src[at + n - 1] = '\0';
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_mem(MicroBenchMemSuite *suite)
+{
+  MicroBenchMemSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  size_t min_size = suite->min_size ? suite->min_size : 1;
+  size_t max_size = suite->max_size ? suite->max_size : ((size_t)64 << 20);
+  unsigned int factor = suite->factor > 1 ? suite->factor : 4;
+  double duration = suite->duration > 0.0 ? suite->duration : 0.05;
+
+  static const char *names[MICRO_BENCH_MEM_KINDS] = {
+    "memcpy", "memmove", "memset", "memcmp", "strlen",
+  };
+  MicroBenchMemImpl libc[MICRO_BENCH_MEM_KINDS];
+  memset(libc, 0, sizeof(libc));
+  for (int k = 0; k < MICRO_BENCH_MEM_KINDS; ++k)
+  {
+    libc[k].name = "libc";
+    libc[k].kind = (MicroBenchMemKind)k;
+  }
+  libc[MICRO_BENCH_MEMCPY].copy = memcpy;
+  libc[MICRO_BENCH_MEMMOVE].copy = memmove;
+  libc[MICRO_BENCH_MEMSET].set = memset;
+  libc[MICRO_BENCH_MEMCMP].compare = memcmp;
+  libc[MICRO_BENCH_STRLEN].length = strlen;
+
+  // Cold pools large enough that the regions touched before a region
+  // comes around again are twice the last level cache at every size
+  size_t llc = micro_bench_llc_size();
+  if (llc == 0) llc = (size_t)64 << 20;
+  size_t pool = 2 * (llc + ((max_size + 63) & ~(size_t)63));
+  MicroBench mb;
+  micro_bench_init(&mb);
+  unsigned char *src = (unsigned char *)micro_bench_alloc(&mb, pool, NULL);
+  unsigned char *dst = (unsigned char *)micro_bench_alloc(&mb, pool, NULL);
+  if (!src || !dst)
+  {
+    micro_bench_teardown(&mb);
+    return;
+  }
+  // Every version leaves the pools as they are, so they are only
+  // rebuilt when strlen needs the terminators for another size
+  memset(src, 0x5a, pool);
+  memset(dst, 0x5a, pool);
+  size_t strings = 0;
+
+  printf("\n");
+  printf("/---------------------------------------------------------------------------------------\\\n");
+  printf("|                                Data movement suite                                    |\n");
+  printf("|---------------------------------------------------------------------------------------|\n");
+  printf("| function | version      |       size | hot ns/op |  hot GB/s | cold ns/op | cold GB/s |\n");
+  printf("|---------------------------------------------------------------------------------------|\n");
+  for (int k = 0; k < MICRO_BENCH_MEM_KINDS; ++k)
+  for (size_t n = min_size; n <= max_size; n *= factor)
+  for (int i = -1; i < micro_bench_mem_impl_count; ++i)
+  {
+    const MicroBenchMemImpl *impl = (i < 0) ? &libc[k]
+                                            : &micro_bench_mem_impls[i];
+    if (impl->kind != (MicroBenchMemKind)k) continue;
+
+    if (k == MICRO_BENCH_STRLEN && strings != n)
+    {
+      micro_bench_mem_strings(src, pool, n);
+      strings = n;
+    }
+    MicroBench run;
+    double hot = micro_bench_mem_measure(impl, dst, src, pool, n, 0,
+                                         duration, &run);
+    double cold = micro_bench_mem_measure(impl, dst, src, pool, n, 1,
+                                          duration, &run);
+    // Whole ns past the column width at the largest sizes
+    printf("| %-8s | %-12.12s | %10zu | %9.*f | %9.3f | %10.*f | %9.3f |\n",
+           names[k], impl->name, n, hot < 1e-4 ? 2 : 0, hot * 1e9,
+           hot > 0.0 ? n / hot / 1e9 : 0.0, cold < 1e-3 ? 2 : 0, cold * 1e9,
+           cold > 0.0 ? n / cold / 1e9 : 0.0);
+  }
+  printf("\\---------------------------------------------------------------------------------------/\n");
+  micro_bench_teardown(&mb);
+  return;
+}
+
+
+//
+// Branch prediction suite
+//
+
+#ifdef __linux__
+// Open a hardware counter of the calling thread, disabled. Returns a
+// file descriptor or -1 when perf is not available.
+static int micro_bench_perf_open(uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t micro_bench_perf_read(int fd)
+{
+  uint64_t value = 0;
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+    return 0;
+  return value;
+}
+#endif
+
+static volatile uint64_t micro_bench_branch_sink;
+
+// Sum the values below the split, with a real branch: the empty asm
+// keeps the compiler from turning it into a conditional move
+static uint64_t micro_bench_branch_pass(const uint32_t *values, size_t count)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (values[i] < MICRO_BENCH_PATTERN_SPLIT)
+    {
+      __asm__ volatile ("");
+      sum += values[i];
+    }
+  }
+  return sum;
+}
+
+// The same work without a branch
+static uint64_t micro_bench_branchless_pass(const uint32_t *values,
+                                            size_t count)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint64_t mask = 0 - (uint64_t)(values[i] < MICRO_BENCH_PATTERN_SPLIT);
+    sum += values[i] & mask;
+  }
+  return sum;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_branch(MicroBenchBranchSuite *suite)
+{
+  MicroBenchBranchSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  size_t count = suite->count ? suite->count : 65536;
+  uint64_t seed = suite->seed ? suite->seed : 1;
+  double duration = suite->duration > 0.0 ? suite->duration : 0.1;
+  size_t periods[8] = {4, 64, 4096};
+  int period_count = 3;
+  if (suite->periods[0])
+    for (period_count = 0; period_count < 8 && suite->periods[period_count];
+         ++period_count)
+      periods[period_count] = suite->periods[period_count];
+
+  MicroBench buffers;
+  micro_bench_init(&buffers);
+  uint32_t *values =
+    (uint32_t *)micro_bench_alloc(&buffers, count * sizeof(*values), NULL);
+  if (!values) return;
+
+  int fd = -1;
+#ifdef __linux__
+  fd = micro_bench_perf_open(PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+
+  // Cases: sorted, random, each period, adversarial, then branchless
+  // on random values
+  int cases = 3 + period_count + 1;
+  double sorted_ns = 0.0, sorted_miss = 0.0;
+  double random_ns = 0.0, random_miss = 0.0;
+
+  printf("\n");
+  printf("/-----------------------------------------------------\\\n");
+  printf("|             Branch prediction suite                 |\n");
+  printf("|-----------------------------------------------------|\n");
+  printf("| pattern           |   ns/value | misses/value       |\n");
+  printf("|-----------------------------------------------------|\n");
+  for (int c = 0; c < cases; ++c)
+  {
+    MicroBenchPattern pattern;
+    size_t period = 0;
+    int branchless = (c == cases - 1);
+    if (c == 0) pattern = MICRO_BENCH_PATTERN_SORTED;
+    else if (c == 1 || branchless) pattern = MICRO_BENCH_PATTERN_RANDOM;
+    else if (c == cases - 2) pattern = MICRO_BENCH_PATTERN_ADVERSARIAL;
+    else
+    {
+      pattern = MICRO_BENCH_PATTERN_PERIODIC;
+      period = periods[c - 2];
+    }
+    micro_bench_pattern_fill(values, count, pattern, period, seed);
+
+    // Train once, then time whole passes
+    micro_bench_branch_sink = micro_bench_branch_pass(values, count);
+    MicroBench mb;
+    micro_bench_init(&mb);
+    uint64_t misses = 0;
+    uint64_t end = micro_bench_time_ns() + (uint64_t)(duration * 1e9);
+    do
+    {
+#ifdef __linux__
+      if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+      micro_bench_start(&mb);
+      micro_bench_branch_sink = branchless
+        ? micro_bench_branchless_pass(values, count)
+        : micro_bench_branch_pass(values, count);
+      micro_bench_stop(&mb);
+#ifdef __linux__
+      if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      misses += micro_bench_perf_read(fd);
+#endif
+    } while (micro_bench_time_ns() < end);
+
+    double ns = mb.data.min_real * 1e9 / count;
+    double miss = (double)misses / ((double)count * mb.data.iterations);
+    if (c == 0) { sorted_ns = ns; sorted_miss = miss; }
+    if (c == 1) { random_ns = ns; random_miss = miss; }
+
+    char name[32];
+    if (branchless)
+      snprintf(name, sizeof(name), "random branchless");
+    else if (period)
+      snprintf(name, sizeof(name), "periodic %zu", period);
+    else
+      snprintf(name, sizeof(name), "%s", micro_bench_pattern_name(pattern));
+    if (fd >= 0)
+      printf("| %-17.17s | %10.3f | %10.4f         |\n", name, ns, miss);
+    else
+      printf("| %-17.17s | %10.3f |        n/a         |\n", name, ns);
+  }
+
+  // Without counters, assume half of the random branches mispredict
+  double extra = (fd >= 0) ? random_miss - sorted_miss : 0.5;
+  printf("|-----------------------------------------------------|\n");
+  printf("| penalty per miss  | %10.3f ns%s|\n",
+         extra > 0.0 ? (random_ns - sorted_ns) / extra : 0.0,
+         (fd >= 0) ? "                   " : " (estimated)       ");
+  printf("\\-----------------------------------------------------/\n");
+  if (fd >= 0) close(fd);
+  micro_bench_teardown(&buffers);
+  return;
+}
+
+
+//
+// Allocator suite
+//
+
+#define MICRO_BENCH_ALLOC_RING 256
+
+enum {
+  MICRO_BENCH_ALLOC_SWEEP = 0,
+  MICRO_BENCH_ALLOC_CROSS,
+  MICRO_BENCH_ALLOC_BURST,
+  MICRO_BENCH_ALLOC_FRAGMENT,
+  MICRO_BENCH_ALLOC_PATTERNS,
+};
+
+typedef struct {
+  void *ptr;
+  size_t size;
+} MicroBenchAllocSlot;
+
+// Single producer single consumer ring between a pair of threads
+typedef struct {
+  MicroBenchAllocSlot slots[MICRO_BENCH_ALLOC_RING];
+  volatile uint64_t head;
+  char pad[MICRO_BENCH_PADDING];
+  volatile uint64_t tail;
+  char pad2[MICRO_BENCH_PADDING];
+} MicroBenchAllocRing;
+
+typedef struct {
+  const MicroBenchAllocImpl *impl;
+  int pattern;
+  const size_t *sizes;
+  int size_count;
+  unsigned int burst;
+  unsigned int live;
+  MicroBenchAllocRing *rings;       // one per pair of threads
+} MicroBenchAllocRun;
+
+static void *micro_bench_libc_alloc(void *ctx, size_t size)
+{
+  (void)ctx;
+  return malloc(size);
+}
+
+static void micro_bench_libc_release(void *ctx, void *ptr, size_t size)
+{
+  (void)ctx; (void)size;
+  free(ptr);
+  return;
+}
+
+// Allocate and touch the first byte, as a caller would
+static void *micro_bench_alloc_timed(MicroBenchThread *thread,
+                                     const MicroBenchAllocImpl *impl,
+                                     size_t size)
+{
+  uint64_t begin = micro_bench_time_ns();
+  void *p = impl->alloc(impl->ctx, size);
+  micro_bench_histogram_add(&thread->histogram,
+                            micro_bench_time_ns() - begin);
+  if (p) *(volatile char *)p = 0;
+  thread->ops++;
+  return p;
+}
+
+static void micro_bench_release_timed(MicroBenchThread *thread,
+                                      const MicroBenchAllocImpl *impl,
+                                      void *p, size_t size)
+{
+  if (!p) return;
+  uint64_t begin = micro_bench_time_ns();
+  impl->release(impl->ctx, p, size);
+  micro_bench_histogram_add(&thread->histogram,
+                            micro_bench_time_ns() - begin);
+  thread->ops++;
+  return;
+}
+
+static void micro_bench_alloc_thread(MicroBenchThread *thread, void *arg)
+{
+  MicroBenchAllocRun *run = (MicroBenchAllocRun *)arg;
+  const MicroBenchAllocImpl *impl = run->impl;
+  uint64_t state = (uint64_t)thread->index + 1;
+
+  switch (run->pattern)
+  {
+  case MICRO_BENCH_ALLOC_SWEEP:
+    while (micro_bench_thread_running(thread))
+    {
+      void *p = micro_bench_alloc_timed(thread, impl, run->sizes[0]);
+      micro_bench_release_timed(thread, impl, p, run->sizes[0]);
+    }
+    break;
+  case MICRO_BENCH_ALLOC_CROSS:
+  {
+    MicroBenchAllocRing *ring = &run->rings[thread->index / 2];
+    if (thread->index % 2 == 0)
+    {
+      while (micro_bench_thread_running(thread))
+      {
+        uint64_t head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+            == MICRO_BENCH_ALLOC_RING)
+        {
+          sched_yield();
+          continue;
+        }
+        size_t size = run->sizes[micro_bench_random(&state) % run->size_count];
+        ring->slots[head % MICRO_BENCH_ALLOC_RING].ptr =
+          micro_bench_alloc_timed(thread, impl, size);
+        ring->slots[head % MICRO_BENCH_ALLOC_RING].size = size;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+      }
+    }
+    else
+    {
+      // What is left in the ring is freed after the run
+      while (micro_bench_thread_running(thread))
+      {
+        uint64_t tail = ring->tail;
+        if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        {
+          sched_yield();
+          continue;
+        }
+        MicroBenchAllocSlot slot = ring->slots[tail % MICRO_BENCH_ALLOC_RING];
+        micro_bench_release_timed(thread, impl, slot.ptr, slot.size);
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+      }
+    }
+    break;
+  }
+  case MICRO_BENCH_ALLOC_BURST:
+  {
+    MicroBenchAllocSlot *slots =
+      (MicroBenchAllocSlot *)malloc(sizeof(*slots) * run->burst);
+    if (!slots) break;
+    while (micro_bench_thread_running(thread))
+    {
+      for (unsigned int i = 0; i < run->burst; ++i)
+      {
+        slots[i].size = run->sizes[micro_bench_random(&state) % run->size_count];
+        slots[i].ptr = micro_bench_alloc_timed(thread, impl, slots[i].size);
+      }
+      for (unsigned int i = 0; i < run->burst; ++i)
+        micro_bench_release_timed(thread, impl, slots[i].ptr, slots[i].size);
+    }
+    free(slots);
+    break;
+  }
+  case MICRO_BENCH_ALLOC_FRAGMENT:
+  {
+    // Untimed fill of the working set, then random replacements
+    MicroBenchAllocSlot *slots =
+      (MicroBenchAllocSlot *)malloc(sizeof(*slots) * run->live);
+    if (!slots) break;
+    for (unsigned int i = 0; i < run->live; ++i)
+    {
+      slots[i].size = run->sizes[micro_bench_random(&state) % run->size_count];
+      slots[i].ptr = impl->alloc(impl->ctx, slots[i].size);
+    }
+    while (micro_bench_thread_running(thread))
+    {
+      MicroBenchAllocSlot *s = &slots[micro_bench_random(&state) % run->live];
+      micro_bench_release_timed(thread, impl, s->ptr, s->size);
+      s->size = run->sizes[micro_bench_random(&state) % run->size_count];
+      s->ptr = micro_bench_alloc_timed(thread, impl, s->size);
+    }
+    for (unsigned int i = 0; i < run->live; ++i)
+      if (slots[i].ptr) impl->release(impl->ctx, slots[i].ptr, slots[i].size);
+    free(slots);
+    break;
+  }
+  default:
+    break;
+  }
+  return;
+}
+
+// Resident set size of the process in bytes, 0 if unknown
+static long micro_bench_rss(void)
+{
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  long size = 0, resident = 0;
+  if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+  fclose(f);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_alloc(MicroBenchAllocSuite *suite)
+{
+  MicroBenchAllocSuite defaults = {0};
+  if (!suite) suite = &defaults;
+
+  static const MicroBenchAllocImpl libc_impl = {
+    "malloc", micro_bench_libc_alloc, micro_bench_libc_release, NULL,
+  };
+  const MicroBenchAllocImpl *impls = suite->impls;
+  int impl_count = suite->impl_count;
+  if (!impls)
+  {
+    impls = &libc_impl;
+    impl_count = 1;
+  }
+
+  int default_threads[32];
+  const int *threads = suite->threads;
+  int thread_count = suite->thread_count;
+  if (!threads)
+  {
+    thread_count = micro_bench_default_threads(default_threads);
+    threads = default_threads;
+  }
+
+  static const size_t default_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536,
+  };
+  const size_t *sizes = suite->sizes;
+  int size_count = suite->size_count;
+  if (!sizes)
+  {
+    sizes = default_sizes;
+    size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+  }
+  unsigned int burst = suite->burst ? suite->burst : 1024;
+  unsigned int live = suite->live ? suite->live : 4096;
+  double duration = suite->duration > 0.0 ? suite->duration : 0.2;
+
+  static const char *pattern_names[MICRO_BENCH_ALLOC_PATTERNS] = {
+    "alloc/free", "cross-thread", "burst", "fragment",
+  };
+
+  printf("\n");
+  printf("/----------------------------------------------------------------------------------------------------------------------\\\n");
+  printf("|                                             Memory allocator suite                                                   |\n");
+  printf("|----------------------------------------------------------------------------------------------------------------------|\n");
+  printf("| allocator    | pattern      |    size | threads |   Mops/s | p50 (ns) | p99 (ns) | p999 (ns) |   max (ns) |  RSS KiB |\n");
+  printf("|----------------------------------------------------------------------------------------------------------------------|\n");
+  for (int i = 0; i < impl_count; ++i)
+  for (int pattern = 0; pattern < MICRO_BENCH_ALLOC_PATTERNS; ++pattern)
+  for (int s = 0; s < (pattern == MICRO_BENCH_ALLOC_SWEEP ? size_count : 1); ++s)
+  for (int t = 0; t < thread_count; ++t)
+  {
+    // Cross-thread frees need pairs of threads
+    int n = threads[t];
+    if (pattern == MICRO_BENCH_ALLOC_CROSS)
+    {
+      n = (n < 2) ? 2 : n + n % 2;
+      int previous = (t > 0) ? threads[t - 1] : 0;
+      if (previous > 0 && ((previous < 2) ? 2 : previous + previous % 2) == n)
+        continue;
+    }
+
+    MicroBenchAllocRun run;
+    memset(&run, 0, sizeof(run));
+    run.impl = &impls[i];
+    run.pattern = pattern;
+    run.sizes = (pattern == MICRO_BENCH_ALLOC_SWEEP) ? &sizes[s] : sizes;
+    run.size_count = (pattern == MICRO_BENCH_ALLOC_SWEEP) ? 1 : size_count;
+    run.burst = burst;
+    run.live = live;
+    if (pattern == MICRO_BENCH_ALLOC_CROSS)
+      run.rings =
+        (MicroBenchAllocRing *)calloc((size_t)n / 2, sizeof(*run.rings));
+
+    char size[16];
+    if (pattern == MICRO_BENCH_ALLOC_SWEEP)
+      snprintf(size, sizeof(size), "%zu", sizes[s]);
+    else
+      snprintf(size, sizeof(size), "mixed");
+
+    long rss = micro_bench_rss();
+    MicroBenchThread *th =
+      (MicroBenchThread *)malloc(sizeof(MicroBenchThread) * (size_t)n);
+    if (!th || (pattern == MICRO_BENCH_ALLOC_CROSS && !run.rings)
+        || micro_bench_run_threads(th, n, duration, suite->pin,
+                                   micro_bench_alloc_thread, &run) != 0)
+    {
+      printf("| %-12.12s | %-12s | %7s | %7d | %-77s|\n", impls[i].name,
+             pattern_names[pattern], size, n, " failed");
+      free(th);
+      free(run.rings);
+      continue;
+    }
+    // Free what the consumers did not reach
+    for (int r = 0; run.rings && r < n / 2; ++r)
+      for (uint64_t k = run.rings[r].tail; k != run.rings[r].head; ++k)
+      {
+        MicroBenchAllocSlot *slot =
+          &run.rings[r].slots[k % MICRO_BENCH_ALLOC_RING];
+        if (slot->ptr) impls[i].release(impls[i].ctx, slot->ptr, slot->size);
+      }
+    long grown = micro_bench_rss() - rss;
+
+    MicroBenchHistogram hist;
+    micro_bench_histogram_clear(&hist);
+    uint64_t total = 0;
+    for (int k = 0; k < n; ++k)
+    {
+      micro_bench_histogram_merge(&hist, &th[k].histogram);
+      total += th[k].ops;
+    }
+    printf("| %-12.12s | %-12s | %7s | %7d | %8.3f | %8llu | %8llu | %9llu | %10llu | %8ld |\n",
+           impls[i].name, pattern_names[pattern], size, n,
+           total / duration / 1e6,
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 99.0),
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 99.9),
+           (unsigned long long)hist.max, grown / 1024);
+    free(th);
+    free(run.rings);
+  }
+  printf("\\----------------------------------------------------------------------------------------------------------------------/\n");
+  return;
+}
+
+
+//
+// Syscall and context switch suite
+//
+
+// Core and package of [cpu] from sysfs, -1 if unknown
+static void micro_bench_cpu_topology(int cpu, int *core, int *package)
+{
+  char path[128];
+  *core = *package = -1;
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+  micro_bench_read_list(path, core, 1);
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  micro_bench_read_list(path, package, 1);
+  return;
+}
+
+MICRO_BENCH_DEF int micro_bench_cpu_pair(MicroBenchPlacement placement,
+                                         int *a, int *b)
+{
+  if (!a || !b) return -1;
+  *a = *b = -1;
+  if (placement == MICRO_BENCH_PLACE_ANY) return 0;
+
+  int cpus[CPU_SETSIZE];
+  int count = micro_bench_cpu_list(cpus, CPU_SETSIZE);
+  if (placement == MICRO_BENCH_PLACE_SAME_CPU)
+  {
+    *a = *b = cpus[0];
+    return 0;
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    int core_i, package_i;
+    micro_bench_cpu_topology(cpus[i], &core_i, &package_i);
+    for (int j = i + 1; j < count; ++j)
+    {
+      int core_j, package_j;
+      micro_bench_cpu_topology(cpus[j], &core_j, &package_j);
+      int same_package = package_i == package_j;
+      int same_core = same_package && core_i == core_j;
+      if ((placement == MICRO_BENCH_PLACE_SMT_SIBLING && same_core)
+          || (placement == MICRO_BENCH_PLACE_OTHER_CORE
+              && same_package && !same_core)
+          || (placement == MICRO_BENCH_PLACE_OTHER_SOCKET && !same_package))
+      {
+        *a = cpus[i];
+        *b = cpus[j];
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+enum {
+  MICRO_BENCH_PING_FUTEX = 0,
+  MICRO_BENCH_PING_PIPE,
+  MICRO_BENCH_PING_EVENTFD,
+  MICRO_BENCH_PING_KINDS,
+};
+
+// Two one way channels, side 0 sends on [fds[0]] and receives on
+// [fds[1]]. The futex word is shared memory, so that it also works
+// across fork.
+typedef struct {
+  int kind;
+  int process;
+  int fds[2][2];                    // pipes: read end, write end
+  int *word;
+  unsigned int iterations;
+  int cpu;                          // of side 1
+  MicroBenchHistogram histogram;    // round trips of side 0
+} MicroBenchPing;
+
+static void micro_bench_ping_send(MicroBenchPing *ping, int side)
+{
+  if (ping->kind == MICRO_BENCH_PING_FUTEX)
+  {
+    __atomic_store_n(ping->word, !side, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, ping->word,
+            ping->process ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+  }
+  else if (ping->kind == MICRO_BENCH_PING_EVENTFD)
+  {
+    uint64_t one = 1;
+    if (write(ping->fds[side][0], &one, sizeof(one)) != sizeof(one))
+      return;
+  }
+  else
+  {
+    char byte = 0;
+    if (write(ping->fds[side][1], &byte, 1) != 1)
+      return;
+  }
+  return;
+}
+
+static void micro_bench_ping_receive(MicroBenchPing *ping, int side)
+{
+  if (ping->kind == MICRO_BENCH_PING_FUTEX)
+  {
+    // Side 0 waits for the word to go back to 0, side 1 for 1
+    int expected = side;
+    int seen;
+    while ((seen = __atomic_load_n(ping->word, __ATOMIC_ACQUIRE)) != expected)
+    {
+#ifdef __linux__
+      syscall(SYS_futex, ping->word,
+              ping->process ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, seen,
+              NULL, NULL, 0);
+#endif
+    }
+  }
+  else if (ping->kind == MICRO_BENCH_PING_EVENTFD)
+  {
+    uint64_t value;
+    if (read(ping->fds[!side][0], &value, sizeof(value)) != sizeof(value))
+      return;
+  }
+  else
+  {
+    char byte;
+    if (read(ping->fds[!side][0], &byte, 1) != 1)
+      return;
+  }
+  return;
+}
+
+// The answering side
+static void micro_bench_ping_echo(MicroBenchPing *ping)
+{
+  if (ping->cpu >= 0) micro_bench_pin_cpu(ping->cpu);
+  for (unsigned int i = 0; i < ping->iterations; ++i)
+  {
+    micro_bench_ping_receive(ping, 1);
+    micro_bench_ping_send(ping, 1);
+  }
+  return;
+}
+
+static void *micro_bench_ping_echo_main(void *arg)
+{
+  micro_bench_ping_echo((MicroBenchPing *)arg);
+  return NULL;
+}
+
+typedef struct {
+  MicroBenchPing *ping;
+  int cpu;
+} MicroBenchPingSide;
+
+// The timing side, a thread of its own to leave the affinity of the
+// caller alone
+static void *micro_bench_ping_main(void *arg)
+{
+  MicroBenchPingSide *side = (MicroBenchPingSide *)arg;
+  MicroBenchPing *ping = side->ping;
+  if (side->cpu >= 0) micro_bench_pin_cpu(side->cpu);
+  unsigned int warmup = ping->iterations / 10;
+  for (unsigned int i = 0; i < ping->iterations; ++i)
+  {
+    uint64_t begin = micro_bench_time_ns();
+    micro_bench_ping_send(ping, 0);
+    micro_bench_ping_receive(ping, 0);
+    if (i >= warmup)
+      micro_bench_histogram_add(&ping->histogram,
+                                micro_bench_time_ns() - begin);
+  }
+  return NULL;
+}
+
+static void micro_bench_ping_close(MicroBenchPing *ping)
+{
+  for (int i = 0; i < 2; ++i)
+    for (int j = 0; j < 2; ++j)
+      if (ping->fds[i][j] >= 0)
+      {
+        // An eventfd is stored twice
+        if (j == 1 && ping->fds[i][1] == ping->fds[i][0]) continue;
+        close(ping->fds[i][j]);
+      }
+  return;
+}
+
+// Returns 0 on success
+static int micro_bench_ping_run(MicroBenchPing *ping, int cpu_a, int cpu_b)
+{
+  memset(ping->fds, -1, sizeof(ping->fds));
+  __atomic_store_n(ping->word, 0, __ATOMIC_RELAXED);
+  micro_bench_histogram_clear(&ping->histogram);
+  ping->cpu = cpu_b;
+  pid_t pid = -1;
+  pthread_t echo, timer;
+  MicroBenchPingSide side = { ping, cpu_a };
+  int err;
+  for (int i = 0; i < 2; ++i)
+  {
+    if (ping->kind == MICRO_BENCH_PING_PIPE)
+    {
+      if (pipe(ping->fds[i]) != 0) goto fail;
+    }
+    else if (ping->kind == MICRO_BENCH_PING_EVENTFD)
+    {
+#ifdef __linux__
+      ping->fds[i][0] = ping->fds[i][1] = eventfd(0, 0);
+#endif
+      if (ping->fds[i][0] < 0) goto fail;
+    }
+  }
+
+  if (ping->process)
+  {
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) goto fail;
+    if (pid == 0)
+    {
+      micro_bench_ping_echo(ping);
+      _exit(0);
+    }
+  }
+  else if (pthread_create(&echo, NULL, micro_bench_ping_echo_main, ping) != 0)
+    goto fail;
+
+  err = pthread_create(&timer, NULL, micro_bench_ping_main, &side);
+  if (err == 0)
+    pthread_join(timer, NULL);
+  if (ping->process)
+  {
+    if (err != 0) kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  else
+  {
+    if (err != 0) pthread_cancel(echo);
+    pthread_join(echo, NULL);
+  }
+  micro_bench_ping_close(ping);
+  return err == 0 ? 0 : -1;
+
+fail:
+  micro_bench_ping_close(ping);
+  return -1;
+}
+
+static volatile long micro_bench_syscall_sink;
+
+MICRO_BENCH_DEF void micro_bench_suite_syscall(MicroBenchSyscallSuite *suite)
+{
+  MicroBenchSyscallSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  unsigned int iterations = suite->iterations ? suite->iterations : 20000;
+  static const MicroBenchPlacement all_placements[] = {
+    MICRO_BENCH_PLACE_ANY, MICRO_BENCH_PLACE_SAME_CPU,
+    MICRO_BENCH_PLACE_SMT_SIBLING, MICRO_BENCH_PLACE_OTHER_CORE,
+    MICRO_BENCH_PLACE_OTHER_SOCKET,
+  };
+  const MicroBenchPlacement *placements = suite->placements;
+  int placement_count = suite->placement_count;
+  if (!placements)
+  {
+    placements = all_placements;
+    placement_count = MICRO_BENCH_PLACES;
+  }
+  static const char *placement_names[MICRO_BENCH_PLACES] = {
+    "any", "same cpu", "smt sibling", "other core", "other socket",
+  };
+  static const char *kind_names[MICRO_BENCH_PING_KINDS] = {
+    "futex", "pipe", "eventfd",
+  };
+
+  printf("\n");
+  printf("/---------------------------------------------------------------------------------------------\\\n");
+  printf("|                             Syscall and context switch suite                                |\n");
+  printf("|---------------------------------------------------------------------------------------------|\n");
+  printf("| operation                     | placement    | mean (ns) | p50 (ns) | p99 (ns) |   max (ns) |\n");
+  printf("|---------------------------------------------------------------------------------------------|\n");
+
+  // Single thread calls, the clock row is the overhead of the timing
+  for (int op = 0; op < 4; ++op)
+  {
+    static const char *op_names[] = {
+      "clock overhead", "getpid", "clock_gettime", "sched_yield",
+    };
+    MicroBenchHistogram hist;
+    micro_bench_histogram_clear(&hist);
+    for (unsigned int i = 0; i < iterations; ++i)
+    {
+      struct timespec ts;
+      uint64_t begin = micro_bench_time_ns();
+      switch (op)
+      {
+      case 1:
+#ifdef __linux__
+        micro_bench_syscall_sink = syscall(SYS_getpid);
+#else
+        micro_bench_syscall_sink = getpid();
+#endif
+        break;
+      case 2:
+        clock_gettime(CLOCK_REALTIME, &ts);
+        micro_bench_syscall_sink = ts.tv_nsec;
+        break;
+      case 3:
+        sched_yield();
+        break;
+      default:
+        break;
+      }
+      micro_bench_histogram_add(&hist, micro_bench_time_ns() - begin);
+    }
+    printf("| %-29s | %-12s | %9.1f | %8llu | %8llu | %10llu |\n",
+           op_names[op], "-", hist.count ? (double)hist.sum / hist.count : 0.0,
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 99.0),
+           (unsigned long long)hist.max);
+  }
+
+  int *word = (int *)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (word == MAP_FAILED) word = NULL;
+  MicroBenchPing *ping = (MicroBenchPing *)malloc(sizeof(*ping));
+  for (int p = 0; p < placement_count && ping && word; ++p)
+  {
+    int a, b;
+    MicroBenchPlacement placement = placements[p];
+    const char *where = (placement < MICRO_BENCH_PLACES)
+                        ? placement_names[placement] : "?";
+    if (micro_bench_cpu_pair(placement, &a, &b) != 0)
+    {
+      printf("| %-29s | %-12s | %-45s|\n", "round trips", where,
+             " no such pair of CPUs");
+      continue;
+    }
+    for (int process = 0; process < 2; ++process)
+    for (int kind = 0; kind < MICRO_BENCH_PING_KINDS; ++kind)
+    {
+      char name[64];
+      snprintf(name, sizeof(name), "%s round trip, %s", kind_names[kind],
+               process ? "processes" : "threads");
+      memset(ping, 0, sizeof(*ping));
+      ping->kind = kind;
+      ping->process = process;
+      ping->word = word;
+      ping->iterations = iterations;
+      if (micro_bench_ping_run(ping, a, b) != 0)
+      {
+        printf("| %-29s | %-12s | %-45s|\n", name, where, " failed");
+        continue;
+      }
+      MicroBenchHistogram *hist = &ping->histogram;
+      printf("| %-29s | %-12s | %9.1f | %8llu | %8llu | %10llu |\n",
+             name, where, hist->count ? (double)hist->sum / hist->count : 0.0,
+             (unsigned long long)micro_bench_histogram_percentile(hist, 50.0),
+             (unsigned long long)micro_bench_histogram_percentile(hist, 99.0),
+             (unsigned long long)hist->max);
+    }
+  }
+  printf("\\---------------------------------------------------------------------------------------------/\n");
+  free(ping);
+  if (word) munmap(word, sizeof(int));
+  return;
+}
+
+
+//
+// Timer wake-up suite
+//
+
+enum {
+  MICRO_BENCH_TIMER_NANOSLEEP = 0,
+  MICRO_BENCH_TIMER_ABSOLUTE,
+  MICRO_BENCH_TIMER_TIMERFD,
+  MICRO_BENCH_TIMER_KINDS,
+};
+
+typedef struct {
+  int kind;
+  int policy;
+  int priority;
+  int cpu;
+  uint64_t interval;
+  unsigned int wakeups;
+  int err;                          // errno of a failed setup
+  uint64_t missed;                  // timerfd expirations not seen
+  MicroBenchHistogram histogram;    // lateness in ns
+} MicroBenchTimerRun;
+
+static struct timespec micro_bench_timespec(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000ull);
+  ts.tv_nsec = (long)(ns % 1000000000ull);
+  return ts;
+}
+
+static void *micro_bench_timer_thread(void *arg)
+{
+  MicroBenchTimerRun *run = (MicroBenchTimerRun *)arg;
+  if (run->cpu >= 0) micro_bench_pin_cpu(run->cpu);
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = (run->policy == SCHED_FIFO) ? run->priority : 0;
+  run->err = pthread_setschedparam(pthread_self(), run->policy, &param);
+  if (run->err != 0) return NULL;
+
+  int fd = -1;
+  uint64_t start = micro_bench_time_ns();
+  if (run->kind == MICRO_BENCH_TIMER_TIMERFD)
+  {
+#ifdef __linux__
+    fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    struct itimerspec spec;
+    spec.it_value = micro_bench_timespec(start + run->interval);
+    spec.it_interval = micro_bench_timespec(run->interval);
+    if (fd < 0 || timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+    {
+      run->err = errno ? errno : ENOSYS;
+      if (fd >= 0) close(fd);
+      return NULL;
+    }
+#else
+    run->err = ENOSYS;
+    return NULL;
+#endif
+  }
+
+  uint64_t target = start;
+  for (unsigned int i = 0; i < run->wakeups; ++i)
+  {
+    if (run->kind == MICRO_BENCH_TIMER_NANOSLEEP)
+    {
+      target = micro_bench_time_ns() + run->interval;
+      struct timespec ts = micro_bench_timespec(run->interval);
+      nanosleep(&ts, NULL);
+    }
+    else if (run->kind == MICRO_BENCH_TIMER_ABSOLUTE)
+    {
+      target += run->interval;
+      struct timespec ts = micro_bench_timespec(target);
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+             == EINTR)
+        ;
+    }
+    else
+    {
+      uint64_t expirations = 0;
+      if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        break;
+      // The timer keeps its period, late reads see several expirations
+      target += run->interval * expirations;
+      run->missed += expirations - 1;
+    }
+    uint64_t now = micro_bench_time_ns();
+    micro_bench_histogram_add(&run->histogram, now > target ? now - target : 0);
+  }
+  if (fd >= 0) close(fd);
+  return NULL;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_timer(MicroBenchTimerSuite *suite)
+{
+  MicroBenchTimerSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  static const uint64_t default_intervals[] = { 100000, 1000000 };
+  const uint64_t *intervals = suite->intervals;
+  int interval_count = suite->interval_count;
+  if (!intervals)
+  {
+    intervals = default_intervals;
+    interval_count = 2;
+  }
+  unsigned int wakeups = suite->wakeups ? suite->wakeups : 1000;
+  int priority = suite->priority ? suite->priority : 50;
+  int cpu = -1;
+  if (suite->pin)
+    micro_bench_cpu_list(&cpu, 1);
+
+  static const char *kind_names[MICRO_BENCH_TIMER_KINDS] = {
+    "nanosleep", "clock_nanosleep", "timerfd",
+  };
+  static const int policies[] = { SCHED_OTHER, SCHED_FIFO };
+  static const char *policy_names[] = { "other", "fifo" };
+  int runs = MICRO_BENCH_TIMER_KINDS * 2 * interval_count;
+  MicroBenchTimerRun *results =
+    (MicroBenchTimerRun *)calloc((size_t)runs, sizeof(*results));
+  if (!results) return;
+
+  printf("\n");
+  printf("/--------------------------------------------------------------------------------------------------\\\n");
+  printf("|                                   Timer wake-up suite                                            |\n");
+  printf("|--------------------------------------------------------------------------------------------------|\n");
+  printf("| mechanism       | policy | interval (ns) | min (ns) | p50 (ns) | p99 (ns) |   max (ns) |  missed |\n");
+  printf("|--------------------------------------------------------------------------------------------------|\n");
+  int r = 0;
+  for (int kind = 0; kind < MICRO_BENCH_TIMER_KINDS; ++kind)
+  for (int p = 0; p < 2; ++p)
+  for (int i = 0; i < interval_count; ++i, ++r)
+  {
+    MicroBenchTimerRun *run = &results[r];
+    run->kind = kind;
+    run->policy = policies[p];
+    run->priority = priority;
+    run->cpu = cpu;
+    run->interval = intervals[i];
+    run->wakeups = wakeups;
+    micro_bench_histogram_clear(&run->histogram);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, micro_bench_timer_thread, run) != 0)
+      run->err = EAGAIN;
+    else
+      pthread_join(thread, NULL);
+
+    if (run->err != 0)
+    {
+      printf("| %-15s | %-6s | %13llu | %-54.54s|\n", kind_names[kind],
+             policy_names[p], (unsigned long long)intervals[i],
+             run->err == EPERM ? " not permitted" : " failed");
+      continue;
+    }
+    MicroBenchHistogram *hist = &run->histogram;
+    printf("| %-15s | %-6s | %13llu | %8llu | %8llu | %8llu | %10llu | %7llu |\n",
+           kind_names[kind], policy_names[p], (unsigned long long)intervals[i],
+           (unsigned long long)hist->min,
+           (unsigned long long)micro_bench_histogram_percentile(hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(hist, 99.0),
+           (unsigned long long)hist->max, (unsigned long long)run->missed);
+  }
+  printf("\\--------------------------------------------------------------------------------------------------/\n");
+
+  for (r = 0; r < runs; ++r)
+  {
+    MicroBenchTimerRun *run = &results[r];
+    if (run->err != 0 || run->histogram.count == 0) continue;
+    char title[64];
+    snprintf(title, sizeof(title), "%s %s %llu ns, late (ns)",
+             kind_names[run->kind], run->policy == SCHED_FIFO ? "fifo" : "other",
+             (unsigned long long)run->interval);
+    micro_bench_histogram_report(&run->histogram, title);
+  }
+  free(results);
+  return;
+}
+
+
+//
+// File I/O suite
+//
+
+enum {
+  MICRO_BENCH_IO_READ = 0,
+  MICRO_BENCH_IO_PREAD,
+  MICRO_BENCH_IO_MMAP,
+  MICRO_BENCH_IO_DIRECT,
+  MICRO_BENCH_IO_URING,
+  MICRO_BENCH_IO_URING_DIRECT,
+  MICRO_BENCH_IO_METHODS,
+};
+
+// The probe and IORING_OP_READ need the Linux 5.6 headers, the
+// methods are reported as not available with older ones
+#if defined(__linux__) && defined(__NR_io_uring_setup) \
+  && defined(IO_URING_OP_SUPPORTED)
+  #define MICRO_BENCH_URING
+#endif
+
+#ifdef MICRO_BENCH_URING
+// The few parts of an io_uring instance used to read, set up with
+// the raw system calls so that liburing is not needed
+typedef struct {
+  int fd;
+  unsigned int *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_size, cq_size, sqes_size;
+} MicroBenchUring;
+
+static void micro_bench_uring_exit(MicroBenchUring *ring)
+{
+  if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_size);
+  if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_size);
+  if (ring->fd >= 0) close(ring->fd);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  return;
+}
+
+// Returns 0 on success, -1 if io_uring is not available
+static int micro_bench_uring_init(MicroBenchUring *ring, unsigned int entries)
+{
+  struct io_uring_params p;
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0) return -1;
+
+  // IORING_OP_READ came with Linux 5.6, like the probe itself
+  uint64_t buf[(sizeof(struct io_uring_probe)
+                + 256 * sizeof(struct io_uring_probe_op)) / 8 + 1];
+  struct io_uring_probe *probe = (struct io_uring_probe *)buf;
+  memset(buf, 0, sizeof(buf));
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+              probe, 256) != 0
+      || probe->last_op < IORING_OP_READ
+      || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED))
+  {
+    micro_bench_uring_exit(ring);
+    return -1;
+  }
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+    ring->cq_size = ring->sq_size;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) ring->sq_ring = NULL;
+  ring->cq_ring = ring->sq_ring;
+  if (ring->sq_ring && !(p.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) ring->cq_ring = NULL;
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE,
+                                           ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+  if (!ring->sq_ring || !ring->cq_ring || !ring->sqes)
+  {
+    micro_bench_uring_exit(ring);
+    return -1;
+  }
+
+  char *sq = (char *)ring->sq_ring;
+  char *cq = (char *)ring->cq_ring;
+  ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+// Queue a read, submitted by the next `micro_bench_uring_enter`
+static void micro_bench_uring_read(MicroBenchUring *ring, int fd, void *buf,
+                                   unsigned int len, uint64_t offset,
+                                   uint64_t user_data)
+{
+  unsigned int tail = *ring->sq_tail;
+  unsigned int index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return;
+}
+
+static int micro_bench_uring_enter(MicroBenchUring *ring, unsigned int submit,
+                                   unsigned int wait)
+{
+  return (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+}
+#endif
+
+typedef struct {
+  int fd;                        // buffered
+  int direct_fd;                 // O_DIRECT, or -1
+  size_t file_size;
+  unsigned char **buffers;       // one per in flight operation
+  uint64_t seed;
+} MicroBenchIoFile;
+
+// Offset of operation [i] of a run
+static uint64_t micro_bench_io_offset(int random, uint64_t i, size_t block,
+                                      size_t file_size, uint64_t *state)
+{
+  uint64_t blocks = file_size / block;
+  if (blocks == 0) return 0;
+  return (random ? micro_bench_random(state) % blocks : i % blocks) * block;
+}
+
+// Run [method] until [duration] elapses, or until one pass over the
+// file for a cold cache. Returns 0 on success, -1 on error and -2 if
+// the method is not available.
+static int micro_bench_io_run(MicroBenchIoFile *file, int method, int random,
+                              int cold, size_t block, unsigned int depth,
+                              double duration, MicroBenchHistogram *hist,
+                              MicroBench *mb)
+{
+  int fd = (method == MICRO_BENCH_IO_DIRECT
+            || method == MICRO_BENCH_IO_URING_DIRECT)
+           ? file->direct_fd : file->fd;
+  if (fd < 0) return -2;
+  uint64_t limit = cold ? file->file_size / block : (uint64_t)-1;
+  if (limit == 0) limit = 1;
+  if (cold)
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_DONTNEED);
+  if (lseek(fd, 0, SEEK_SET) != 0) return -1;
+
+  unsigned char *map = NULL;
+  if (method == MICRO_BENCH_IO_MMAP)
+  {
+    map = (unsigned char *)mmap(NULL, file->file_size, PROT_READ,
+                                MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -1;
+  }
+
+  micro_bench_histogram_clear(hist);
+  micro_bench_init(mb);
+  uint64_t state = file->seed;
+  uint64_t end = micro_bench_time_ns() + (uint64_t)(duration * 1e9);
+  uint64_t ops = 0;
+  int err = 0;
+  unsigned char *buf = file->buffers[0];
+  int uring = method == MICRO_BENCH_IO_URING
+              || method == MICRO_BENCH_IO_URING_DIRECT;
+
+  // The ring is set up before the timer, like the mapping above
+#ifdef MICRO_BENCH_URING
+  MicroBenchUring ring;
+  if (uring && micro_bench_uring_init(&ring, depth) != 0)
+    return -2;
+#else
+  (void)depth;
+  if (uring) return -2;
+#endif
+
+  micro_bench_start(mb);
+  if (uring)
+  {
+#ifdef MICRO_BENCH_URING
+    // Keep [depth] reads in flight, the user data is the slot
+    uint64_t issued[256];
+    unsigned int in_flight = 0, pending = 0;
+    for (unsigned int s = 0; s < depth && ops + in_flight < limit; ++s)
+    {
+      uint64_t offset = micro_bench_io_offset(random, ops + in_flight, block,
+                                              file->file_size, &state);
+      issued[s] = micro_bench_time_ns();
+      micro_bench_uring_read(&ring, fd, file->buffers[s], (unsigned int)block,
+                             offset, s);
+      in_flight++;
+      pending++;
+    }
+    while (in_flight > 0)
+    {
+      if (micro_bench_uring_enter(&ring, pending, 1) < 0 && errno != EINTR)
+      {
+        err = -1;
+        break;
+      }
+      pending = 0;
+      unsigned int head = *ring.cq_head;
+      while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+      {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        unsigned int s = (unsigned int)cqe->user_data;
+        uint64_t now = micro_bench_time_ns();
+        if (cqe->res < 0)
+          err = -1;
+        else
+          micro_bench_add_bytes(mb, (uint64_t)cqe->res);
+        micro_bench_histogram_add(hist, now - issued[s]);
+        head++;
+        in_flight--;
+        ops++;
+        if (err == 0 && now < end && ops + in_flight < limit)
+        {
+          uint64_t offset = micro_bench_io_offset(random, ops + in_flight,
+                                                  block, file->file_size,
+                                                  &state);
+          issued[s] = micro_bench_time_ns();
+          micro_bench_uring_read(&ring, fd, file->buffers[s],
+                                 (unsigned int)block, offset, s);
+          in_flight++;
+          pending++;
+        }
+      }
+      __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+#endif
+  }
+  else
+  {
+    while (ops < limit && micro_bench_time_ns() < end)
+    {
+      uint64_t offset = micro_bench_io_offset(random, ops, block,
+                                              file->file_size, &state);
+      uint64_t begin = micro_bench_time_ns();
+      ssize_t n = (ssize_t)block;
+      switch (method)
+      {
+      case MICRO_BENCH_IO_READ:
+        // Sequential reads follow the file position
+        if (random || offset == 0)
+          lseek(fd, (off_t)offset, SEEK_SET);
+        n = read(fd, buf, block);
+        break;
+      case MICRO_BENCH_IO_MMAP:
+        memcpy(buf, map + offset, block);
+        break;
+      default:
+        n = pread(fd, buf, block, (off_t)offset);
+        break;
+      }
+      micro_bench_histogram_add(hist, micro_bench_time_ns() - begin);
+      if (n < 0)
+      {
+        err = -1;
+        break;
+      }
+      micro_bench_add_bytes(mb, (uint64_t)n);
+      ops++;
+    }
+  }
+  micro_bench_stop(mb);
+  if (map) munmap(map, file->file_size);
+#ifdef MICRO_BENCH_URING
+  if (uring) micro_bench_uring_exit(&ring);
+#endif
+  return err;
+}
+
+// Write [size] bytes of random data to [path]. Returns 0 on success.
+static int micro_bench_io_create(const char *path, size_t size, uint64_t seed)
+{
+  int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (fd < 0) return -1;
+  static uint64_t chunk[1 << 17];
+  uint64_t state = seed;
+  size_t written = 0;
+  while (written < size)
+  {
+    for (size_t i = 0; i < sizeof(chunk) / sizeof(chunk[0]); ++i)
+      chunk[i] = micro_bench_random(&state);
+    size_t n = size - written < sizeof(chunk) ? size - written : sizeof(chunk);
+    if (write(fd, chunk, n) != (ssize_t)n)
+    {
+      close(fd);
+      return -1;
+    }
+    written += n;
+  }
+  fsync(fd);
+  close(fd);
+  return 0;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_io(MicroBenchIoSuite *suite)
+{
+  MicroBenchIoSuite defaults = {0};
+  if (!suite) suite = &defaults;
+  const char *path = suite->path ? suite->path : "micro-bench-io.tmp";
+  size_t file_size = suite->file_size ? suite->file_size : ((size_t)256 << 20);
+  static const size_t default_blocks[] = { 4096, 65536, 1 << 20 };
+  const size_t *blocks = suite->block_sizes;
+  int block_count = suite->block_size_count;
+  if (!blocks)
+  {
+    blocks = default_blocks;
+    block_count = 3;
+  }
+  static const unsigned int default_depths[] = { 1, 16 };
+  const unsigned int *depths = suite->depths;
+  int depth_count = suite->depth_count;
+  if (!depths)
+  {
+    depths = default_depths;
+    depth_count = 2;
+  }
+  double duration = suite->duration > 0.0 ? suite->duration : 0.1;
+  uint64_t seed = suite->seed ? suite->seed : 1;
+
+  unsigned int max_depth = 1;
+  for (int d = 0; d < depth_count; ++d)
+    if (depths[d] > max_depth) max_depth = depths[d];
+  if (max_depth > 256) max_depth = 256;
+  size_t max_block = 0;
+  for (int b = 0; b < block_count; ++b)
+    if (blocks[b] > max_block) max_block = blocks[b];
+
+  if (micro_bench_io_create(path, file_size, seed) != 0)
+  {
+    printf("micro_bench_suite_io: cannot create %s\n", path);
+    return;
+  }
+  micro_bench_metadata_set("io.file", "%s", path);
+  micro_bench_metadata_set("io.seed", "%llu", (unsigned long long)seed);
+
+  // O_DIRECT buffers must be aligned to the logical block size
+  MicroBench buffers;
+  micro_bench_init(&buffers);
+  MicroBenchAllocOptions options;
+  memset(&options, 0, sizeof(options));
+  options.alignment = 4096;
+  options.flags = MICRO_BENCH_ALLOC_PREFAULT;
+  unsigned char *slots[256];
+  MicroBenchIoFile file;
+  file.fd = open(path, O_RDONLY);
+#ifdef O_DIRECT
+  file.direct_fd = open(path, O_RDONLY | O_DIRECT);
+#else
+  file.direct_fd = -1;
+#endif
+  file.file_size = file_size;
+  file.buffers = slots;
+  file.seed = seed;
+  int ok = file.fd >= 0;
+  for (unsigned int s = 0; s < max_depth && ok; ++s)
+    ok = (slots[s] = (unsigned char *)micro_bench_alloc(&buffers, max_block,
+                                                        &options)) != NULL;
+
+  static const char *method_names[MICRO_BENCH_IO_METHODS] = {
+    "read", "pread", "mmap", "O_DIRECT", "io_uring", "io_uring O_DIRECT",
+  };
+  printf("\n");
+  printf("/---------------------------------------------------------------------------------------------------------\\\n");
+  printf("|                                              File I/O suite                                             |\n");
+  printf("|---------------------------------------------------------------------------------------------------------|\n");
+  printf("| method            | access     | cache  |   block | depth |     MB/s | p50 (ns) | p99 (ns) |   max (ns) |\n");
+  printf("|---------------------------------------------------------------------------------------------------------|\n");
+  for (int method = 0; ok && method < MICRO_BENCH_IO_METHODS; ++method)
+  for (int random = 0; random < 2; ++random)
+  for (int cold = 1; cold >= 0; --cold)
+  for (int b = 0; b < block_count; ++b)
+  for (int d = 0; d < depth_count; ++d)
+  {
+    int direct = method == MICRO_BENCH_IO_DIRECT
+                 || method == MICRO_BENCH_IO_URING_DIRECT;
+    int uring = method == MICRO_BENCH_IO_URING
+                || method == MICRO_BENCH_IO_URING_DIRECT;
+    // The page cache does not matter to O_DIRECT, the depth only to
+    // io_uring
+    if ((direct && !cold) || (!uring && d > 0)) continue;
+    unsigned int depth = uring ? depths[d] : 1;
+    if (depth > max_depth) depth = max_depth;
+
+    MicroBenchHistogram hist;
+    MicroBench mb;
+    int err = micro_bench_io_run(&file, method, random, cold, blocks[b],
+                                 depth, duration, &hist, &mb);
+    const char *cache = direct ? "direct" : (cold ? "cold" : "warm");
+    if (err != 0)
+    {
+      printf("| %-17s | %-10s | %-6s | %7zu | %5u | %-44s|\n",
+             method_names[method], random ? "random" : "sequential", cache,
+             blocks[b], depth, err == -2 ? " not available" : " failed");
+      continue;
+    }
+    printf("| %-17s | %-10s | %-6s | %7zu | %5u | %8.1f | %8llu | %8llu | %10llu |\n",
+           method_names[method], random ? "random" : "sequential", cache,
+           blocks[b], depth, micro_bench_get_bytes_per_second(&mb) / 1e6,
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&hist, 99.0),
+           (unsigned long long)hist.max);
+  }
+  printf("\\---------------------------------------------------------------------------------------------------------/\n");
+
+  if (file.fd >= 0) close(file.fd);
+  if (file.direct_fd >= 0) close(file.direct_fd);
+  micro_bench_teardown(&buffers);
+  if (!suite->keep) unlink(path);
+  return;
+}
+
+
+//
+// Loopback networking suite
+//
+
+enum {
+  MICRO_BENCH_NET_TCP = 0,
+  MICRO_BENCH_NET_TCP_NODELAY,
+  MICRO_BENCH_NET_UDP,
+  MICRO_BENCH_NET_UNIX_STREAM,
+  MICRO_BENCH_NET_UNIX_DGRAM,
+  MICRO_BENCH_NET_KINDS,
+};
+
+#define MICRO_BENCH_UDP_MAX 65507
+
+typedef struct {
+  int kind;
+  int streaming;
+  int fds[2];                       // client, server
+  size_t size;
+  unsigned int iterations;
+  double duration;
+  int cpus[2];
+  unsigned char *buffers[2];
+  volatile int done;                // the client stopped sending
+  int err;
+  uint64_t start_ns;                // first message sent
+  uint64_t last_ns;                 // last message received
+  uint64_t bytes;                   // received by the server
+  uint64_t messages;                // sent by the client
+  MicroBenchHistogram histogram;    // round trips, or sends
+} MicroBenchNetRun;
+
+// Connect [fds] over [kind]. Returns 0 on success.
+static int micro_bench_net_pair(int kind, int fds[2])
+{
+  fds[0] = fds[1] = -1;
+  if (kind == MICRO_BENCH_NET_UNIX_STREAM || kind == MICRO_BENCH_NET_UNIX_DGRAM)
+    return socketpair(AF_UNIX, kind == MICRO_BENCH_NET_UNIX_STREAM
+                      ? SOCK_STREAM : SOCK_DGRAM, 0, fds);
+
+  struct sockaddr_in addr[2];
+  socklen_t len = sizeof(addr[0]);
+  int type = (kind == MICRO_BENCH_NET_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+  int listener = socket(AF_INET, type, 0);
+  fds[0] = socket(AF_INET, type, 0);
+  memset(addr, 0, sizeof(addr));
+  addr[0].sin_family = AF_INET;
+  addr[0].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr[0].sin_port = 0;
+  if (listener < 0 || fds[0] < 0
+      || bind(listener, (struct sockaddr *)&addr[0], sizeof(addr[0])) != 0
+      || getsockname(listener, (struct sockaddr *)&addr[0], &len) != 0)
+    goto fail;
+
+  if (type == SOCK_DGRAM)
+  {
+    // Both ends bound and connected to each other
+    addr[1] = addr[0];
+    addr[1].sin_port = 0;
+    len = sizeof(addr[1]);
+    if (bind(fds[0], (struct sockaddr *)&addr[1], sizeof(addr[1])) != 0
+        || getsockname(fds[0], (struct sockaddr *)&addr[1], &len) != 0
+        || connect(fds[0], (struct sockaddr *)&addr[0], sizeof(addr[0])) != 0
+        || connect(listener, (struct sockaddr *)&addr[1], sizeof(addr[1])) != 0)
+      goto fail;
+    fds[1] = listener;
+    return 0;
+  }
+
+  if (listen(listener, 1) != 0
+      || connect(fds[0], (struct sockaddr *)&addr[0], sizeof(addr[0])) != 0)
+    goto fail;
+  fds[1] = accept(listener, NULL, NULL);
+  close(listener);
+  if (fds[1] < 0) goto fail_connected;
+  {
+    int flag = (kind == MICRO_BENCH_NET_TCP_NODELAY);
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+  return 0;
+
+fail:
+  if (listener >= 0) close(listener);
+fail_connected:
+  if (fds[0] >= 0) close(fds[0]);
+  fds[0] = fds[1] = -1;
+  return -1;
+}
+
+// Send or receive a whole message, a single call for datagrams.
+// Returns the bytes moved, 0 at end of stream, -1 on error.
+static ssize_t micro_bench_net_io(int fd, unsigned char *buf, size_t size,
+                                  int stream, int receive)
+{
+  size_t done = 0;
+  do
+  {
+    ssize_t n = receive ? recv(fd, buf + done, size - done, 0)
+                        : send(fd, buf + done, size - done, MSG_NOSIGNAL);
+    if (n <= 0) return n;
+    done += (size_t)n;
+  } while (stream && done < size);
+  return (ssize_t)done;
+}
+
+static void *micro_bench_net_server(void *arg)
+{
+  MicroBenchNetRun *run = (MicroBenchNetRun *)arg;
+  int stream = run->kind != MICRO_BENCH_NET_UDP
+               && run->kind != MICRO_BENCH_NET_UNIX_DGRAM;
+  if (run->cpus[1] >= 0) micro_bench_pin_cpu(run->cpus[1]);
+  unsigned char *buf = run->buffers[1];
+  if (run->streaming)
+  {
+    // Take whatever arrives, a timeout ends a datagram stream
+    for (;;)
+    {
+      ssize_t n = recv(run->fds[1], buf, run->size, 0);
+      if (n > 0)
+      {
+        run->bytes += (uint64_t)n;
+        run->last_ns = micro_bench_time_ns();
+        continue;
+      }
+      if (n == 0 || __atomic_load_n(&run->done, __ATOMIC_ACQUIRE)) break;
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+    }
+    return NULL;
+  }
+  for (unsigned int i = 0; i < run->iterations; ++i)
+  {
+    if (micro_bench_net_io(run->fds[1], buf, run->size, stream, 1) <= 0
+        || micro_bench_net_io(run->fds[1], buf, run->size, stream, 0) <= 0)
+      break;
+  }
+  return NULL;
+}
+
+static void *micro_bench_net_client(void *arg)
+{
+  MicroBenchNetRun *run = (MicroBenchNetRun *)arg;
+  int stream = run->kind != MICRO_BENCH_NET_UDP
+               && run->kind != MICRO_BENCH_NET_UNIX_DGRAM;
+  if (run->cpus[0] >= 0) micro_bench_pin_cpu(run->cpus[0]);
+  unsigned char *buf = run->buffers[0];
+  run->start_ns = micro_bench_time_ns();
+  if (run->streaming)
+  {
+    uint64_t end = run->start_ns + (uint64_t)(run->duration * 1e9);
+    while (micro_bench_time_ns() < end)
+    {
+      uint64_t begin = micro_bench_time_ns();
+      if (micro_bench_net_io(run->fds[0], buf, run->size, stream, 0) < 0)
+      {
+        // A full datagram queue is not an error
+        if (stream || (errno != ENOBUFS && errno != EAGAIN))
+        {
+          run->err = -1;
+          break;
+        }
+        continue;
+      }
+      micro_bench_histogram_add(&run->histogram, micro_bench_time_ns() - begin);
+      run->messages++;
+    }
+    __atomic_store_n(&run->done, 1, __ATOMIC_RELEASE);
+    if (stream) shutdown(run->fds[0], SHUT_WR);
+    return NULL;
+  }
+  unsigned int warmup = run->iterations / 10;
+  for (unsigned int i = 0; i < run->iterations; ++i)
+  {
+    uint64_t begin = micro_bench_time_ns();
+    if (micro_bench_net_io(run->fds[0], buf, run->size, stream, 0) <= 0
+        || micro_bench_net_io(run->fds[0], buf, run->size, stream, 1) <= 0)
+    {
+      run->err = -1;
+      break;
+    }
+    uint64_t now = micro_bench_time_ns();
+    if (i == warmup) run->start_ns = begin;
+    if (i >= warmup)
+    {
+      micro_bench_histogram_add(&run->histogram, now - begin);
+      run->messages++;
+      run->last_ns = now;
+    }
+  }
+  return NULL;
+}
+
+// Returns 0 on success
+static int micro_bench_net_run(MicroBenchNetRun *run)
+{
+  if (micro_bench_net_pair(run->kind, run->fds) != 0) return -1;
+  // Lost datagrams must not block either side forever
+  struct timeval timeout;
+  timeout.tv_sec = run->streaming ? 0 : 1;
+  timeout.tv_usec = run->streaming ? 100000 : 0;
+  setsockopt(run->fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(run->fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  pthread_t server, client;
+  int err = -1;
+  if (pthread_create(&server, NULL, micro_bench_net_server, run) == 0)
+  {
+    if (pthread_create(&client, NULL, micro_bench_net_client, run) == 0)
+    {
+      pthread_join(client, NULL);
+      err = run->err;
+    }
+    else
+      shutdown(run->fds[0], SHUT_RDWR);
+    __atomic_store_n(&run->done, 1, __ATOMIC_RELEASE);
+    pthread_join(server, NULL);
+  }
+  close(run->fds[0]);
+  close(run->fds[1]);
+  return err;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_net(MicroBenchNetSuite *suite)
+{
+  MicroBenchNetSuite defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  if (!suite) suite = &defaults;
+  static const size_t default_sizes[] = { 64, 1024, 16384, 65536 };
+  const size_t *sizes = suite->sizes;
+  int size_count = suite->size_count;
+  if (!sizes)
+  {
+    sizes = default_sizes;
+    size_count = 4;
+  }
+  unsigned int iterations = suite->iterations ? suite->iterations : 10000;
+  double duration = suite->duration > 0.0 ? suite->duration : 0.2;
+  int cpus[2];
+  if (micro_bench_cpu_pair(suite->placement, &cpus[0], &cpus[1]) != 0)
+  {
+    printf("micro_bench_suite_net: no such pair of CPUs\n");
+    return;
+  }
+  size_t max_size = 0;
+  for (int s = 0; s < size_count; ++s)
+    if (sizes[s] > max_size) max_size = sizes[s];
+
+  MicroBench buffers;
+  micro_bench_init(&buffers);
+  unsigned char *client_buf =
+    (unsigned char *)micro_bench_alloc(&buffers, max_size, NULL);
+  unsigned char *server_buf =
+    (unsigned char *)micro_bench_alloc(&buffers, max_size, NULL);
+  MicroBenchNetRun *run = (MicroBenchNetRun *)malloc(sizeof(*run));
+  if (!client_buf || !server_buf || !run)
+  {
+    free(run);
+    micro_bench_teardown(&buffers);
+    return;
+  }
+
+  static const char *kind_names[MICRO_BENCH_NET_KINDS] = {
+    "tcp", "tcp nodelay", "udp", "unix stream", "unix dgram",
+  };
+  printf("\n");
+  printf("/----------------------------------------------------------------------------------------------\\\n");
+  printf("|                                  Loopback networking suite                                   |\n");
+  printf("|----------------------------------------------------------------------------------------------|\n");
+  printf("| transport   | mode      |    size |      msg/s |     MB/s | p50 (ns) | p99 (ns) |   max (ns) |\n");
+  printf("|----------------------------------------------------------------------------------------------|\n");
+  for (int kind = 0; kind < MICRO_BENCH_NET_KINDS; ++kind)
+  for (int streaming = 0; streaming < 2; ++streaming)
+  for (int s = 0; s < size_count; ++s)
+  {
+    const char *mode = streaming ? "streaming" : "ping-pong";
+    if (kind == MICRO_BENCH_NET_UDP && sizes[s] > MICRO_BENCH_UDP_MAX)
+    {
+      printf("| %-11s | %-9s | %7zu | %-57s|\n", kind_names[kind], mode,
+             sizes[s], " too large for a datagram");
+      continue;
+    }
+    memset(run, 0, sizeof(*run));
+    run->kind = kind;
+    run->streaming = streaming;
+    run->size = sizes[s];
+    run->iterations = iterations;
+    run->duration = duration;
+    run->cpus[0] = cpus[0];
+    run->cpus[1] = cpus[1];
+    run->buffers[0] = client_buf;
+    run->buffers[1] = server_buf;
+    micro_bench_histogram_clear(&run->histogram);
+    if (micro_bench_net_run(run) != 0 || run->messages == 0)
+    {
+      printf("| %-11s | %-9s | %7zu | %-57s|\n", kind_names[kind], mode,
+             sizes[s], " failed");
+      continue;
+    }
+
+    // Ping-pong counts round trips, streaming what the server got
+    double seconds = (run->last_ns > run->start_ns)
+                     ? (run->last_ns - run->start_ns) / 1e9 : 0.0;
+    double rate = 0.0, bandwidth = 0.0;
+    if (seconds > 0.0)
+    {
+      rate = streaming ? run->bytes / (double)run->size / seconds
+                       : run->messages / seconds;
+      bandwidth = streaming ? run->bytes / seconds / 1e6
+                            : 2.0 * run->size * run->messages / seconds / 1e6;
+    }
+    MicroBenchHistogram *hist = &run->histogram;
+    printf("| %-11s | %-9s | %7zu | %10.0f | %8.1f | %8llu | %8llu | %10llu |\n",
+           kind_names[kind], mode, sizes[s], rate, bandwidth,
+           (unsigned long long)micro_bench_histogram_percentile(hist, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(hist, 99.0),
+           (unsigned long long)hist->max);
+  }
+  printf("\\----------------------------------------------------------------------------------------------/\n");
+  free(run);
+  micro_bench_teardown(&buffers);
+  return;
+}
+
+
+//
+// Shared memory IPC suite
+//
+
+#define MICRO_BENCH_SHM_SLOTS 256
+#define MICRO_BENCH_SHM_HEADER 64   // timestamp, then the payload
+
+enum {
+  MICRO_BENCH_SHM_POLL = 0,
+  MICRO_BENCH_SHM_FUTEX,
+  MICRO_BENCH_SHM_EVENTFD,
+  MICRO_BENCH_SHM_KINDS,
+};
+
+// A ring of MICRO_BENCH_SHM_SLOTS slots of [slot_size] bytes. The
+// consumer sets [waiting] before sleeping, the producer wakes it only
+// then.
+typedef struct {
+  volatile uint32_t head;
+  char pad[MICRO_BENCH_PADDING];
+  volatile uint32_t tail;
+  char pad2[MICRO_BENCH_PADDING];
+  volatile uint32_t waiting;
+  int efd;
+  unsigned char *slots;
+} MicroBenchShmRing;
+
+// Lives in the shared mapping, followed by the slots of both rings
+typedef struct {
+  MicroBenchShmRing rings[2];       // side 0 to 1, side 1 to 0
+  int kind;
+  int streaming;
+  size_t size;
+  size_t slot_size;
+  double duration;
+  double tsc_hz;
+  volatile int stop;
+  int cpus[2];
+  // Results
+  MicroBenchHistogram round_trip;   // side 0, ns
+  MicroBenchHistogram one_way;      // side 1, ns
+  uint64_t bytes;                   // received by side 1
+  uint64_t first_tsc, last_tsc;     // side 1, first and last receive
+  int64_t skew;                     // side 1 minus side 0, cycles
+  uint64_t skew_error;              // half of the best round trip
+} MicroBenchShm;
+
+// Timestamp counter, or the monotonic clock in ns on other hosts
+static uint64_t micro_bench_tsc(void)
+{
+#ifdef MICRO_BENCH_X86
+  unsigned int lo, hi;
+  __asm__ volatile ("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+  return ((uint64_t)hi << 32) | lo;
+#else
+  return micro_bench_time_ns();
+#endif
+}
+
+// Ticks of `micro_bench_tsc` per second
+static double micro_bench_tsc_hz(void)
+{
+  uint64_t ns0 = micro_bench_time_ns(), tsc0 = micro_bench_tsc();
+  while (micro_bench_time_ns() - ns0 < 20000000)
+    ;
+  uint64_t ns1 = micro_bench_time_ns(), tsc1 = micro_bench_tsc();
+  return (double)(tsc1 - tsc0) * 1e9 / (double)(ns1 - ns0);
+}
+
+static uint64_t micro_bench_shm_ns(MicroBenchShm *shm, uint64_t ticks)
+{
+  return (uint64_t)((double)ticks * 1e9 / shm->tsc_hz);
+}
+
+static void micro_bench_shm_notify(MicroBenchShm *shm, MicroBenchShmRing *ring)
+{
+  if (shm->kind == MICRO_BENCH_SHM_POLL) return;
+  if (!__atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST)) return;
+  if (shm->kind == MICRO_BENCH_SHM_FUTEX)
+  {
+#ifdef __linux__
+    syscall(SYS_futex, &ring->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+  }
+  else
+  {
+    uint64_t one = 1;
+    if (write(ring->efd, &one, sizeof(one)) != sizeof(one))
+      return;
+  }
+  return;
+}
+
+// Wait for a message in [ring]. Returns its slot, or NULL once the
+// run is stopped.
+static unsigned char *micro_bench_shm_receive(MicroBenchShm *shm,
+                                              MicroBenchShmRing *ring)
+{
+  uint32_t tail = ring->tail;
+  unsigned int spins = 0;
+  for (;;)
+  {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head != tail)
+      return ring->slots + (tail % MICRO_BENCH_SHM_SLOTS) * shm->slot_size;
+    if (__atomic_load_n(&shm->stop, __ATOMIC_ACQUIRE)) return NULL;
+    if (shm->kind == MICRO_BENCH_SHM_POLL)
+    {
+      // Let the peer run when both share a CPU
+      if (++spins % 4096 == 0) sched_yield();
+      continue;
+    }
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail
+        || __atomic_load_n(&shm->stop, __ATOMIC_SEQ_CST))
+      continue;
+    if (shm->kind == MICRO_BENCH_SHM_FUTEX)
+    {
+#ifdef __linux__
+      syscall(SYS_futex, &ring->head, FUTEX_WAIT, tail, NULL, NULL, 0);
+#endif
+    }
+    else
+    {
+      uint64_t value;
+      if (read(ring->efd, &value, sizeof(value)) != sizeof(value))
+        return NULL;
+    }
+  }
+}
+
+static void micro_bench_shm_release(MicroBenchShmRing *ring)
+{
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+  return;
+}
+
+// Copy [payload] into the next slot, stamped with the counter.
+// Returns 0, or -1 once the run is stopped.
+static int micro_bench_shm_send(MicroBenchShm *shm, MicroBenchShmRing *ring,
+                                const unsigned char *payload, uint64_t stamp)
+{
+  uint32_t head = ring->head;
+  unsigned int spins = 0;
+  while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+         == MICRO_BENCH_SHM_SLOTS)
+  {
+    if (__atomic_load_n(&shm->stop, __ATOMIC_ACQUIRE)) return -1;
+    if (++spins % 64 == 0) sched_yield();
+  }
+  unsigned char *slot = ring->slots + (head % MICRO_BENCH_SHM_SLOTS)
+                                      * shm->slot_size;
+  if (stamp == 0) stamp = micro_bench_tsc();
+  memcpy(slot, &stamp, sizeof(stamp));
+  memcpy(slot + MICRO_BENCH_SHM_HEADER, payload, shm->size);
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+  micro_bench_shm_notify(shm, ring);
+  return 0;
+}
+
+static void micro_bench_shm_stop(MicroBenchShm *shm)
+{
+  __atomic_store_n(&shm->stop, 1, __ATOMIC_SEQ_CST);
+  for (int r = 0; r < 2; ++r)
+  {
+    // Wake a sleeping consumer whatever its state
+    __atomic_store_n(&shm->rings[r].waiting, 1, __ATOMIC_SEQ_CST);
+    micro_bench_shm_notify(shm, &shm->rings[r]);
+  }
+  return;
+}
+
+// Side 0 sends and times round trips, side 1 answers and times the
+// one way trip. [skew] runs exchange counter values instead.
+static void micro_bench_shm_side(MicroBenchShm *shm, int side, int skew,
+                                 unsigned char *payload)
+{
+  MicroBenchShmRing *out = &shm->rings[side];
+  MicroBenchShmRing *in = &shm->rings[!side];
+  if (side == 1)
+  {
+    unsigned char *slot;
+    while ((slot = micro_bench_shm_receive(shm, in)) != NULL)
+    {
+      uint64_t now = micro_bench_tsc(), stamp;
+      memcpy(&stamp, slot, sizeof(stamp));
+      memcpy(payload, slot + MICRO_BENCH_SHM_HEADER, shm->size);
+      micro_bench_shm_release(in);
+      if (shm->streaming)
+      {
+        // Both ends on this side's counter, the skew does not apply
+        if (shm->bytes == 0) shm->first_tsc = now;
+        shm->last_tsc = now;
+        shm->bytes += shm->size;
+        continue;
+      }
+      if (!skew)
+        micro_bench_histogram_add(&shm->one_way, now > stamp
+                                  ? micro_bench_shm_ns(shm, now - stamp) : 0);
+      if (micro_bench_shm_send(shm, out, payload, skew ? now : 0) != 0)
+        break;
+    }
+    return;
+  }
+
+  uint64_t end = micro_bench_time_ns() + (uint64_t)(shm->duration * 1e9);
+  uint64_t best = (uint64_t)-1;
+  while (micro_bench_time_ns() < end)
+  {
+    uint64_t begin = micro_bench_tsc();
+    if (micro_bench_shm_send(shm, out, payload, begin) != 0) break;
+    if (shm->streaming) continue;
+    unsigned char *slot = micro_bench_shm_receive(shm, in);
+    if (!slot) break;
+    uint64_t now = micro_bench_tsc(), remote;
+    memcpy(&remote, slot, sizeof(remote));
+    micro_bench_shm_release(in);
+    if (!skew)
+    {
+      micro_bench_histogram_add(&shm->round_trip,
+                                micro_bench_shm_ns(shm, now - begin));
+      continue;
+    }
+    // The offset of the best exchange has the smallest error
+    if (now - begin < best)
+    {
+      best = now - begin;
+      shm->skew = (int64_t)(remote - begin) - (int64_t)(best / 2);
+      shm->skew_error = best / 2;
+    }
+  }
+  micro_bench_shm_stop(shm);
+  return;
+}
+
+// Fork the two sides, wait for them. Returns 0 on success.
+static int micro_bench_shm_run(MicroBenchShm *shm, int skew)
+{
+  shm->stop = 0;
+  for (int r = 0; r < 2; ++r)
+  {
+    shm->rings[r].head = shm->rings[r].tail = 0;
+    shm->rings[r].waiting = 0;
+  }
+  micro_bench_histogram_clear(&shm->round_trip);
+  micro_bench_histogram_clear(&shm->one_way);
+  shm->bytes = shm->first_tsc = shm->last_tsc = 0;
+
+  pid_t pids[2] = { -1, -1 };
+  fflush(stdout);
+  for (int side = 0; side < 2; ++side)
+  {
+    pids[side] = fork();
+    if (pids[side] == 0)
+    {
+      if (shm->cpus[side] >= 0) micro_bench_pin_cpu(shm->cpus[side]);
+      unsigned char *payload =
+        (unsigned char *)malloc(shm->size ? shm->size : 1);
+      if (payload)
+      {
+        memset(payload, side, shm->size);
+        micro_bench_shm_side(shm, side, skew, payload);
+      }
+      _exit(payload ? 0 : 1);
+    }
+    if (pids[side] < 0)
+    {
+      micro_bench_shm_stop(shm);
+      break;
+    }
+  }
+  int err = 0;
+  for (int side = 0; side < 2; ++side)
+  {
+    int status = 0;
+    if (pids[side] < 0 || waitpid(pids[side], &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      err = -1;
+  }
+  return err;
+}
+
+MICRO_BENCH_DEF void micro_bench_suite_shm(MicroBenchShmSuite *suite)
+{
+  MicroBenchShmSuite defaults;
+  memset(&defaults, 0, sizeof(defaults));
+  if (!suite) suite = &defaults;
+  static const size_t default_sizes[] = { 8, 256, 4096, 65536 };
+  const size_t *sizes = suite->sizes;
+  int size_count = suite->size_count;
+  if (!sizes)
+  {
+    sizes = default_sizes;
+    size_count = 4;
+  }
+  double duration = suite->duration > 0.0 ? suite->duration : 0.2;
+  int cpus[2];
+  if (micro_bench_cpu_pair(suite->placement, &cpus[0], &cpus[1]) != 0)
+  {
+    printf("micro_bench_suite_shm: no such pair of CPUs\n");
+    return;
+  }
+  size_t max_size = 0;
+  for (int s = 0; s < size_count; ++s)
+    if (sizes[s] > max_size) max_size = sizes[s];
+
+  // Inherited by the forked sides, at the same address
+  size_t slot_size = (MICRO_BENCH_SHM_HEADER + max_size + 63) & ~(size_t)63;
+  size_t map_size = sizeof(MicroBenchShm)
+                    + 2 * MICRO_BENCH_SHM_SLOTS * slot_size + 64;
+  void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return;
+  MicroBenchShm *shm = (MicroBenchShm *)map;
+  memset(shm, 0, sizeof(*shm));
+  unsigned char *slots = (unsigned char *)map
+                         + ((sizeof(MicroBenchShm) + 63) & ~(size_t)63);
+  for (int r = 0; r < 2; ++r)
+  {
+    shm->rings[r].slots = slots + r * MICRO_BENCH_SHM_SLOTS * slot_size;
+    shm->rings[r].efd = -1;
+#ifdef __linux__
+    shm->rings[r].efd = eventfd(0, 0);
+#endif
+  }
+  shm->cpus[0] = cpus[0];
+  shm->cpus[1] = cpus[1];
+  shm->tsc_hz = micro_bench_tsc_hz();
+
+  // Counter skew between the two sides, with polling
+  shm->kind = MICRO_BENCH_SHM_POLL;
+  shm->size = 8;
+  shm->slot_size = slot_size;
+  shm->duration = 0.05;
+  int skew_ok = micro_bench_shm_run(shm, 1) == 0;
+  double skew_ns = (double)shm->skew * 1e9 / shm->tsc_hz;
+  double skew_error_ns = (double)shm->skew_error * 1e9 / shm->tsc_hz;
+  micro_bench_metadata_set("shm.tsc_skew_ns", "%.0f +- %.0f", skew_ns,
+                           skew_error_ns);
+
+  static const char *kind_names[MICRO_BENCH_SHM_KINDS] = {
+    "busy poll", "futex", "eventfd",
+  };
+  printf("\n");
+  printf("/--------------------------------------------------------------------------------------------\\\n");
+  printf("|                                 Shared memory IPC suite                                    |\n");
+  printf("|--------------------------------------------------------------------------------------------|\n");
+  char line[128];
+  snprintf(line, sizeof(line), "counter %.0f MHz, skew %.0f ns +- %.0f ns%s",
+           shm->tsc_hz / 1e6, skew_ok ? skew_ns : 0.0,
+           skew_ok ? skew_error_ns : 0.0,
+           (!skew_ok || micro_bench_abs(skew_ns) > skew_error_ns)
+           ? ", one way times are off" : "");
+  printf("| %-90.90s |\n", line);
+  printf("|--------------------------------------------------------------------------------------------|\n");
+  printf("| notify     |    size | 1-way p50 | 1-way p99 |  rtt p50 |  rtt p99 |      msg/s |     MB/s |\n");
+  printf("|--------------------------------------------------------------------------------------------|\n");
+  for (int kind = 0; kind < MICRO_BENCH_SHM_KINDS; ++kind)
+  for (int s = 0; s < size_count; ++s)
+  {
+    if (kind == MICRO_BENCH_SHM_EVENTFD
+        && (shm->rings[0].efd < 0 || shm->rings[1].efd < 0))
+      continue;
+    shm->kind = kind;
+    shm->size = sizes[s];
+    shm->duration = duration;
+    shm->streaming = 0;
+    int err = micro_bench_shm_run(shm, 0);
+    MicroBenchHistogram round_trip = shm->round_trip;
+    MicroBenchHistogram one_way = shm->one_way;
+    shm->streaming = 1;
+    err = err ? err : micro_bench_shm_run(shm, 0);
+    shm->streaming = 0;
+    if (err != 0)
+    {
+      printf("| %-10s | %7zu | %-70s|\n", kind_names[kind], sizes[s], " failed");
+      continue;
+    }
+    double seconds = (shm->last_tsc > shm->first_tsc)
+      ? (double)(shm->last_tsc - shm->first_tsc) / shm->tsc_hz : 0.0;
+    // The interval starts when the first message arrives
+    double messages = sizes[s] ? (double)shm->bytes / sizes[s] - 1.0 : 0.0;
+    printf("| %-10s | %7zu | %9llu | %9llu | %8llu | %8llu | %10.0f | %8.1f |\n",
+           kind_names[kind], sizes[s],
+           (unsigned long long)micro_bench_histogram_percentile(&one_way, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&one_way, 99.0),
+           (unsigned long long)micro_bench_histogram_percentile(&round_trip, 50.0),
+           (unsigned long long)micro_bench_histogram_percentile(&round_trip, 99.0),
+           seconds > 0.0 ? messages / seconds : 0.0,
+           seconds > 0.0 ? messages * sizes[s] / seconds / 1e6 : 0.0);
+  }
+  printf("\\--------------------------------------------------------------------------------------------/\n");
+  for (int r = 0; r < 2; ++r)
+    if (shm->rings[r].efd >= 0) close(shm->rings[r].efd);
+  munmap(map, map_size);
+  return;
+}
+
+
+//
+// Command benchmarking
+//
+
+// Copy [in] to [out], replacing "{name}" with the value of each
+// "name=value" of [params]. Unknown names are kept as they are.
+static void micro_bench_command_expand(const char *in, const char *const *params,
+                                       int param_count, char *out, size_t size)
+{
+  size_t n = 0;
+  while (*in && n + 1 < size)
+  {
+    const char *value = NULL;
+    size_t skip = 0;
+    if (*in == '{')
+    {
+      for (int p = 0; p < param_count && !value; ++p)
+      {
+        const char *eq = strchr(params[p], '=');
+        if (!eq) continue;
+        size_t len = (size_t)(eq - params[p]);
+        if (strncmp(in + 1, params[p], len) == 0 && in[1 + len] == '}')
+        {
+          value = eq + 1;
+          skip = len + 2;
+        }
+      }
+    }
+    if (!value)
+    {
+      out[n++] = *in++;
+      continue;
+    }
+    while (*value && n + 1 < size)
+      out[n++] = *value++;
+    in += skip;
+  }
+  out[n] = '\0';
+  return;
+}
+
+// Fork and exec [command] with the shell, and wait for it. Returns
+// the pid, or -1 if it could not start.
+static pid_t micro_bench_command_exec(const char *command, int show_output,
+                                      int *status, struct rusage *usage)
+{
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    if (!show_output)
+    {
+      int null = open("/dev/null", O_WRONLY);
+      if (null >= 0)
+      {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+      }
+    }
+    execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit(127);
+  }
+  if (pid < 0) return -1;
+  while (wait4(pid, status, 0, usage) < 0)
+    if (errno != EINTR) return -1;
+  return pid;
+}
+
+static double micro_bench_timeval(struct timeval tv)
+{
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+MICRO_BENCH_DEF int micro_bench_command_run(MicroBenchCommand *cmd)
+{
+  if (!cmd || !cmd->command) return -1;
+  unsigned int runs = cmd->runs ? cmd->runs : 10;
+  char prepare[MICRO_BENCH_COMMAND_MAX], cleanup[MICRO_BENCH_COMMAND_MAX];
+  micro_bench_command_expand(cmd->command, cmd->params, cmd->param_count,
+                             cmd->expanded, sizeof(cmd->expanded));
+  if (cmd->prepare)
+    micro_bench_command_expand(cmd->prepare, cmd->params, cmd->param_count,
+                               prepare, sizeof(prepare));
+  if (cmd->cleanup)
+    micro_bench_command_expand(cmd->cleanup, cmd->params, cmd->param_count,
+                               cleanup, sizeof(cleanup));
+  micro_bench_init(&cmd->mb);
+  memset(&cmd->user, 0, sizeof(cmd->user));
+  memset(&cmd->sys, 0, sizeof(cmd->sys));
+  memset(&cmd->max_rss, 0, sizeof(cmd->max_rss));
+  memset(&cmd->minor_faults, 0, sizeof(cmd->minor_faults));
+  memset(&cmd->major_faults, 0, sizeof(cmd->major_faults));
+  cmd->failed = 0;
+
+  for (unsigned int i = 0; i < cmd->warmup + runs; ++i)
+  {
+    int status = 0;
+    struct rusage usage;
+    // A run on a state that was not prepared is not recorded
+    if (cmd->prepare
+        && (micro_bench_command_exec(prepare, cmd->show_output, &status,
+                                     &usage) < 0
+            || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+      return -1;
+
+    uint64_t begin = micro_bench_time_ns();
+    pid_t pid = micro_bench_command_exec(cmd->expanded, cmd->show_output,
+                                         &status, &usage);
+    uint64_t end = micro_bench_time_ns();
+    if (pid < 0) return -1;
+    if (i >= cmd->warmup)
+    {
+      double user = micro_bench_timeval(usage.ru_utime);
+      double sys = micro_bench_timeval(usage.ru_stime);
+      micro_bench_data_add(&cmd->mb.data, user + sys, (end - begin) / 1e9);
+      micro_bench_stat_add(&cmd->user, user);
+      micro_bench_stat_add(&cmd->sys, sys);
+      micro_bench_stat_add(&cmd->max_rss, (double)usage.ru_maxrss);
+      micro_bench_stat_add(&cmd->minor_faults, (double)usage.ru_minflt);
+      micro_bench_stat_add(&cmd->major_faults, (double)usage.ru_majflt);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        cmd->failed++;
+    }
+
+    if (cmd->cleanup
+        && (micro_bench_command_exec(cleanup, cmd->show_output, &status,
+                                     &usage) < 0
+            || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+      return -1;
+  }
+  return 0;
+}
+
+MICRO_BENCH_DEF void micro_bench_command_report(MicroBenchCommand *cmd)
+{
+  if (!cmd) return;
+  printf("\n$ %s\n", cmd->expanded);
+  micro_bench_report(&cmd->mb);
+  printf("\n");
+  printf("/---------------------------------------\\\n");
+  printf("|       Command resource usage          |\n");
+  printf("|---------------------------------------|\n");
+  printf("|   mean user      |  %12.7f s    |\n", cmd->user.mean);
+  printf("|   mean sys       |  %12.7f s    |\n", cmd->sys.mean);
+  printf("|   max RSS        |  %12.0f KiB  |\n", cmd->max_rss.max);
+  printf("|   minor faults   |  %12.1f      |\n", cmd->minor_faults.mean);
+  printf("|   major faults   |  %12.1f      |\n", cmd->major_faults.mean);
+  printf("|   failed runs    |  %12u      |\n", cmd->failed);
+  printf("\\---------------------------------------/\n");
+  return;
+}
+
+MICRO_BENCH_DEF void micro_bench_command_compare(MicroBenchCommand *cmds,
+                                                 int count)
+{
+  if (!cmds || count <= 0) return;
+  int fastest = 0;
+  for (int i = 1; i < count; ++i)
+    if (cmds[i].mb.data.mean_real < cmds[fastest].mb.data.mean_real)
+      fastest = i;
+  double base = cmds[fastest].mb.data.mean_real;
+  double base_sd = micro_bench_sqrt(cmds[fastest].mb.data.variance_real);
+
+  printf("\n");
+  printf("/--------------------------------------------------------------------------------\\\n");
+  printf("|                               Command comparison                               |\n");
+  printf("|--------------------------------------------------------------------------------|\n");
+  printf("| command                        |   mean (s) | stddev (s) |  relative           |\n");
+  printf("|--------------------------------------------------------------------------------|\n");
+  for (int i = 0; i < count; ++i)
+  {
+    MicroBenchData *d = &cmds[i].mb.data;
+    double sd = micro_bench_sqrt(d->variance_real);
+    // Propagate the relative errors of both means
+    double ratio = base > 0.0 ? d->mean_real / base : 0.0;
+    double error = 0.0;
+    if (base > 0.0 && d->mean_real > 0.0)
+      error = ratio * micro_bench_sqrt((sd / d->mean_real) * (sd / d->mean_real)
+                                       + (base_sd / base) * (base_sd / base));
+    printf("| %-30.30s | %10.6f | %10.6f | %7.3f +- %-8.3f |\n",
+           cmds[i].expanded, d->mean_real, sd, ratio, error);
+  }
+  printf("\\--------------------------------------------------------------------------------/\n");
+  return;
+}
+
+
+//
+// Process startup breakdown
+//
+
+enum {
+  MICRO_BENCH_STARTUP_LAZY = 0,
+  MICRO_BENCH_STARTUP_BIND_NOW,
+  MICRO_BENCH_STARTUP_STATISTICS,
+};
+
+// Read the pipes [fds] of the child [pid] into [out] until both are
+// closed, together so that a child writing a lot to one of them
+// never blocks. A grandchild may keep them open after the child
+// exits, so the child is also waited for, then the exit time is only
+// accurate to a millisecond. Writes the exit status to [status] and
+// returns the time of the exit.
+static uint64_t micro_bench_startup_collect(pid_t pid, int fds[2],
+                                            char *out[2], size_t size[2],
+                                            int *status)
+{
+  size_t len[2] = { 0, 0 };
+  uint64_t exit_ns = 0;
+  int exited = 0;
+  while (fds[0] >= 0 || fds[1] >= 0)
+  {
+    struct pollfd pfd[2];
+    for (int i = 0; i < 2; ++i)
+    {
+      pfd[i].fd = fds[i];
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+    int ready = poll(pfd, 2, exited ? 0 : 1);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready <= 0)
+    {
+      // Nothing left to read once the child is gone
+      if (exited || ready < 0) break;
+      if (waitpid(pid, status, WNOHANG) == pid)
+      {
+        exit_ns = micro_bench_time_ns();
+        exited = 1;
+      }
+      continue;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+      if (fds[i] < 0 || !pfd[i].revents) continue;
+      // Past the end of the buffer the data is dropped
+      char sink[256];
+      char *dst = sink;
+      size_t room = sizeof(sink);
+      if (len[i] + 1 < size[i])
+      {
+        dst = out[i] + len[i];
+        room = size[i] - 1 - len[i];
+      }
+      ssize_t n = read(fds[i], dst, room);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0)
+      {
+        close(fds[i]);
+        fds[i] = -1;
+      }
+      else if (dst != sink)
+        len[i] += (size_t)n;
+    }
+  }
+  for (int i = 0; i < 2; ++i)
+  {
+    if (fds[i] >= 0) close(fds[i]);
+    if (size[i] > 0) out[i][len[i]] = '\0';
+  }
+  if (!exited)
+  {
+    waitpid(pid, status, 0);
+    exit_ns = micro_bench_time_ns();
+  }
+  return exit_ns;
+}
+
+// The number after [key] in [text], or 0
+static uint64_t micro_bench_find_number(const char *text, const char *key)
+{
+  const char *at = strstr(text, key);
+  return at ? strtoull(at + strlen(key), NULL, 10) : 0;
+}
+
+// Run the program once in [mode]. Fills [names] and [times] with the
+// marks, "exec" first and "exit" last, and [stats] with the output of
+// LD_DEBUG. Returns the number of marks, or -1 on error.
+static int micro_bench_startup_once(MicroBenchStartup *startup, int mode,
+                                    char names[][64], uint64_t *times,
+                                    char *stats, size_t stats_size)
+{
+  int marks[2], errs[2] = { -1, -1 };
+  if (pipe(marks) != 0) return -1;
+  if (mode == MICRO_BENCH_STARTUP_STATISTICS && pipe(errs) != 0)
+  {
+    close(marks[0]); close(marks[1]);
+    return -1;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    close(marks[0]);
+    if (errs[0] >= 0) close(errs[0]);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+    {
+      dup2(null, STDOUT_FILENO);
+      dup2(errs[1] >= 0 ? errs[1] : null, STDERR_FILENO);
+      close(null);
+    }
+    if (errs[1] >= 0) close(errs[1]);
+    char fd[16];
+    snprintf(fd, sizeof(fd), "%d", marks[1]);
+    setenv("MICRO_BENCH_STARTUP_FD", fd, 1);
+    if (mode == MICRO_BENCH_STARTUP_BIND_NOW) setenv("LD_BIND_NOW", "1", 1);
+    else unsetenv("LD_BIND_NOW");
+    if (mode == MICRO_BENCH_STARTUP_STATISTICS)
+      setenv("LD_DEBUG", "statistics", 1);
+    char line[64];
+    int len = snprintf(line, sizeof(line), "exec %llu\n",
+                       (unsigned long long)micro_bench_time_ns());
+    if (write(marks[1], line, (size_t)len) != len) _exit(127);
+    execv(startup->argv[0], startup->argv);
+    _exit(127);
+  }
+  close(marks[1]);
+  if (errs[1] >= 0) close(errs[1]);
+  if (pid < 0)
+  {
+    close(marks[0]);
+    if (errs[0] >= 0) close(errs[0]);
+    return -1;
+  }
+
+  char buf[4096];
+  int fds[2] = { marks[0], errs[0] };
+  char *out[2] = { buf, stats };
+  size_t size[2] = { sizeof(buf), stats_size };
+  int status = 0;
+  stats[0] = '\0';
+  uint64_t exit_ns = micro_bench_startup_collect(pid, fds, out, size,
+                                                 &status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) return -1;
+
+  int count = 0;
+  char *line = buf;
+  while (*line && count < MICRO_BENCH_STARTUP_MARKS - 1)
+  {
+    char *end = strchr(line, '\n');
+    if (!end) break;
+    *end = '\0';
+    char *space = strrchr(line, ' ');
+    if (space)
+    {
+      *space = '\0';
+      snprintf(names[count], 64, "%.63s", line);
+      times[count++] = strtoull(space + 1, NULL, 10);
+    }
+    line = end + 1;
+  }
+  snprintf(names[count], 64, "exit");
+  times[count++] = exit_ns;
+  return count;
+}
+
+MICRO_BENCH_DEF int micro_bench_startup_run(MicroBenchStartup *startup)
+{
+  if (!startup || !startup->argv || !startup->argv[0]) return -1;
+  unsigned int runs = startup->runs ? startup->runs : 20;
+  startup->mark_count = 0;
+  startup->failed = 0;
+  memset(startup->phases, 0, sizeof(startup->phases));
+  memset(&startup->lazy, 0, sizeof(startup->lazy));
+  memset(&startup->bind_now, 0, sizeof(startup->bind_now));
+  memset(&startup->loader, 0, sizeof(startup->loader));
+  memset(&startup->relocation, 0, sizeof(startup->relocation));
+
+  char names[MICRO_BENCH_STARTUP_MARKS][64];
+  uint64_t times[MICRO_BENCH_STARTUP_MARKS];
+  char stats[8192];
+  for (int mode = 0; mode < 3; ++mode)
+  for (unsigned int i = 0; i < runs; ++i)
+  {
+    int count = micro_bench_startup_once(startup, mode, names, times,
+                                         stats, sizeof(stats));
+    if (count < 2)
+    {
+      startup->failed++;
+      continue;
+    }
+    // The last mark of the program, before the exit
+    double to_last = (times[count > 2 ? count - 2 : 1] - times[0]) / 1e9;
+    if (mode == MICRO_BENCH_STARTUP_LAZY)
+    {
+      // The first run sets the milestones, runs that differ are failed
+      if (startup->mark_count == 0)
+      {
+        startup->mark_count = count;
+        memcpy(startup->marks, names, sizeof(names));
+      }
+      int same = count == startup->mark_count;
+      for (int m = 0; same && m < count; ++m)
+        same = strcmp(names[m], startup->marks[m]) == 0;
+      if (!same)
+      {
+        startup->failed++;
+        continue;
+      }
+      for (int m = 0; m + 1 < count; ++m)
+        micro_bench_stat_add(&startup->phases[m],
+                             (times[m + 1] - times[m]) / 1e9);
+      micro_bench_stat_add(&startup->lazy, to_last);
+    }
+    else if (mode == MICRO_BENCH_STARTUP_BIND_NOW)
+      micro_bench_stat_add(&startup->bind_now, to_last);
+    else
+    {
+      uint64_t loader = micro_bench_find_number(stats,
+        "total startup time in dynamic loader:");
+      uint64_t relocation = micro_bench_find_number(stats,
+        "time needed for relocation:");
+      // Static executables print nothing
+      if (loader > 0)
+      {
+        micro_bench_stat_add(&startup->loader, (double)loader);
+        micro_bench_stat_add(&startup->relocation, (double)relocation);
+      }
+    }
+  }
+  return (startup->lazy.count > 0) ? 0 : -1;
+}
+
+MICRO_BENCH_DEF void micro_bench_startup_report(MicroBenchStartup *startup)
+{
+  if (!startup) return;
+  printf("\n");
+  printf("/-------------------------------------------------------------------------------\\\n");
+  printf("|                          Process startup breakdown                            |\n");
+  printf("|-------------------------------------------------------------------------------|\n");
+  printf("| phase                       |  mean (us) |   min (us) |   max (us) |  sd (us) |\n");
+  printf("|-------------------------------------------------------------------------------|\n");
+  for (int m = 0; m + 1 < startup->mark_count; ++m)
+  {
+    char phase[2 * 64 + 8];
+    snprintf(phase, sizeof(phase), "%s -> %s", startup->marks[m],
+             startup->marks[m + 1]);
+    MicroBenchStat *s = &startup->phases[m];
+    printf("| %-27.27s | %10.1f | %10.1f | %10.1f | %8.1f |\n", phase,
+           s->mean * 1e6, s->min * 1e6, s->max * 1e6,
+           micro_bench_sqrt(s->variance) * 1e6);
+  }
+  printf("|-------------------------------------------------------------------------------|\n");
+  MicroBenchStat *modes[2] = { &startup->lazy, &startup->bind_now };
+  static const char *mode_names[2] = { "to last mark, lazy", "to last mark, bind now" };
+  for (int m = 0; m < 2; ++m)
+    printf("| %-27s | %10.1f | %10.1f | %10.1f | %8.1f |\n", mode_names[m],
+           modes[m]->mean * 1e6, modes[m]->min * 1e6, modes[m]->max * 1e6,
+           micro_bench_sqrt(modes[m]->variance) * 1e6);
+  printf("|-------------------------------------------------------------------------------|\n");
+  if (startup->loader.count > 0)
+  {
+    printf("| loader (cycles)             | %10.0f | %10.0f | %10.0f | %8.0f |\n",
+           startup->loader.mean, startup->loader.min, startup->loader.max,
+           micro_bench_sqrt(startup->loader.variance));
+    printf("| relocation (cycles)         | %10.0f | %10.0f | %10.0f | %8.0f |\n",
+           startup->relocation.mean, startup->relocation.min,
+           startup->relocation.max,
+           micro_bench_sqrt(startup->relocation.variance));
+  }
+  else
+    printf("| %-77s |\n", "no loader statistics, static executable?");
+  printf("| %-27s | %-47u |\n", "failed runs", startup->failed);
+  printf("\\-------------------------------------------------------------------------------/\n");
+  return;
+}
+
+#endif // MICRO_BENCH_SUITES
+
 #endif // MICRO_BENCH_IMPLEMENTATION
 
 //
@@ -362,7 +7613,7 @@ int fib(int x) {
 int main(void)
 {
   MicroBench mb;
-  micro_bench_clear(&mb);
+  micro_bench_init(&mb);
 
   printf("Calculating fibonacci numbers...\n");
   for (volatile int i = 0; i < 10; ++i)
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Smoke test of the optional parts of the header: builds them with
+// every feature enabled and runs the cheap paths once. Linked with
+// the --wrap flags of MICRO_BENCH_LOCK_WRAP, see the Makefile.
+
+#define MICRO_BENCH_SUITES
+#define MICRO_BENCH_LOCK_PROFILE
+#define MICRO_BENCH_LOCK_WRAP
+#define MICRO_BENCH_USDT
+#define MICRO_BENCH_IMPLEMENTATION
+#include "micro-bench.h"
+
+static int failures;
+
+#define CHECK(cond)                                             \
+  do {                                                          \
+    if (!(cond))                                                \
+    {                                                           \
+      fprintf(stderr, "%s:%d: check failed: %s\n",              \
+              __FILE__, __LINE__, #cond);                       \
+      failures++;                                               \
+    }                                                           \
+  } while (0)
+
+static volatile uint64_t sink;
+
+static void body_sweep(void *dst, void *src, size_t size, void *arg)
+{
+  (void)arg;
+  memcpy(dst, src, size);
+  return;
+}
+
+static void body_layout(MicroBench *mb, void *arg)
+{
+  (void)arg;
+  for (int i = 0; i < 4; ++i)
+  {
+    micro_bench_start(mb);
+    sink += (uint64_t)i;
+    micro_bench_stop(mb);
+  }
+  return;
+}
+
+static size_t serialize_u64(void *out, size_t capacity, const void *input)
+{
+  if (capacity < sizeof(uint64_t)) return 0;
+  memcpy(out, input, sizeof(uint64_t));
+  return sizeof(uint64_t);
+}
+
+static void replay_u64(const void *record, size_t size, void *arg)
+{
+  uint64_t value;
+  if (size != sizeof(value)) return;
+  memcpy(&value, record, sizeof(value));
+  *(uint64_t *)arg += value;
+  return;
+}
+
+static void smoke_core(void)
+{
+  MicroBench mb;
+  micro_bench_init(&mb);
+
+  MicroBenchTrend trend;
+  micro_bench_trend_init(&trend, 4, 0.5);
+  micro_bench_trend_enable(&mb, &trend);
+  micro_bench_schedstat_enable(&mb);  // -1 without schedstat, fine
+
+  MicroBenchAllocOptions options = { 64, 8, MICRO_BENCH_ALLOC_PREFAULT, 0 };
+  unsigned char *buffer =
+    (unsigned char *)micro_bench_alloc(&mb, 4096, &options);
+  CHECK(buffer != NULL);
+  CHECK(((uintptr_t)buffer & 63) == 8);
+  CHECK(micro_bench_buffer_flags(&mb, buffer) & MICRO_BENCH_ALLOC_PREFAULT);
+
+  // Clearing keeps the buffers and the trend
+  for (int round = 0; round < 2; ++round)
+  {
+    micro_bench_clear(&mb);
+    for (int i = 0; i < 16 && buffer; ++i)
+    {
+      micro_bench_start(&mb);
+      memset(buffer, i, 4096);
+      micro_bench_stop(&mb);
+      micro_bench_add_bytes(&mb, 4096);
+    }
+  }
+  CHECK(mb.data.iterations == 16);
+  CHECK(mb.trend == &trend);
+  CHECK(micro_bench_buffer_flags(&mb, buffer) != 0);
+  micro_bench_report(&mb);
+  micro_bench_trend_report(&trend);
+
+  MicroBenchWorkload workload;
+  memset(&workload, 0, sizeof(workload));
+  workload.dist = MICRO_BENCH_KEYS_ZIPF;
+  workload.keys = 1000;
+  uint64_t *keys = micro_bench_workload(&mb, &workload, 256);
+  CHECK(keys != NULL);
+  for (int i = 0; i < 256 && keys; ++i)
+    CHECK(keys[i] < 1000);
+  micro_bench_teardown(&mb);
+  return;
+}
+
+static void smoke_sweep(void)
+{
+  MicroBenchSweep sweep;
+  memset(&sweep, 0, sizeof(sweep));
+  sweep.size = 64;
+  sweep.max_offset = 10000;
+  sweep.step = 5000;
+  sweep.page_cross = 1;
+  sweep.samples = 2;
+  sweep.repeat = 2;
+  // Twice, the second run replaces the points of the first
+  CHECK(micro_bench_sweep_offsets(&sweep, body_sweep, NULL) == 0);
+  CHECK(micro_bench_sweep_offsets(&sweep, body_sweep, NULL) == 0);
+  CHECK(sweep.point_count == 16);
+  CHECK(sweep.repeat == 2 && sweep.calls == 2);
+  micro_bench_sweep_report(&sweep);
+  micro_bench_sweep_free(&sweep);
+
+  MicroBenchLayouts layouts;
+  memset(&layouts, 0, sizeof(layouts));
+  layouts.layouts = 2;
+  CHECK(micro_bench_run_layouts(&layouts, body_layout, NULL) == 0);
+  CHECK(layouts.failed == 0);
+  CHECK(layouts.data.iterations == 8);
+  micro_bench_layouts_report(&layouts);
+  return;
+}
+
+static void smoke_capture(void)
+{
+  char path[] = "/tmp/micro-bench-smoke-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  if (fd < 0) return;
+  close(fd);
+
+  MicroBenchCapture capture;
+  memset(&capture, 0, sizeof(capture));
+  capture.serialize = serialize_u64;
+  CHECK(micro_bench_capture_open(&capture, path) == 0);
+  for (uint64_t i = 1; i <= 10; ++i)
+    micro_bench_capture(&capture, &i);
+  CHECK(micro_bench_capture_close(&capture) == 0);
+  CHECK(capture.recorded == 10);
+
+  MicroBenchReplay replay;
+  memset(&replay, 0, sizeof(replay));
+  uint64_t sum = 0;
+  MicroBench mb;
+  micro_bench_init(&mb);
+  CHECK(micro_bench_replay_open(&replay, path) == 0);
+  CHECK(micro_bench_replay_run(&replay, &mb, replay_u64, &sum) == 10);
+  CHECK(sum == 55);
+  micro_bench_replay_close(&replay);
+  unlink(path);
+  return;
+}
+
+static void smoke_locks(void)
+{
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  micro_bench_lock_clear();
+  for (int i = 0; i < 4; ++i)
+  {
+    micro_bench_mutex_lock(&mutex);
+    micro_bench_mutex_unlock(&mutex);
+  }
+  // Through the linker, recorded by caller address
+  pthread_mutex_lock(&mutex);
+  pthread_mutex_unlock(&mutex);
+
+  MicroBenchLockSite sites[MICRO_BENCH_LOCK_SITES];
+  int count = micro_bench_lock_sites(sites, MICRO_BENCH_LOCK_SITES);
+  CHECK(count == 2);
+  micro_bench_lock_report();
+  return;
+}
+
+static void smoke_processes(void)
+{
+  MicroBenchCommand cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.command = "/bin/true";
+  cmd.prepare = "/bin/true";
+  cmd.runs = 2;
+  CHECK(micro_bench_command_run(&cmd) == 0);
+  CHECK(cmd.failed == 0);
+  micro_bench_command_report(&cmd);
+
+  cmd.prepare = "/bin/false";
+  CHECK(micro_bench_command_run(&cmd) == -1);
+
+  char *argv[] = { (char *)"/bin/true", NULL };
+  MicroBenchStartup startup;
+  memset(&startup, 0, sizeof(startup));
+  startup.argv = argv;
+  startup.runs = 2;
+  CHECK(micro_bench_startup_run(&startup) == 0);
+  micro_bench_startup_report(&startup);
+  return;
+}
+
+int main(void)
+{
+  smoke_core();
+  smoke_sweep();
+  smoke_capture();
+  smoke_locks();
+  smoke_processes();
+  if (failures)
+  {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("\nAll smoke checks passed\n");
+  return 0;
+}